@@ -11,13 +11,15 @@
 #include <signal.h>
 #include <stdio.h>
 #include <complex.h>
-#include <fftw3.h>
 #include <math.h>
 #include <float.h>
 #include <limits.h>
 #include <unistd.h>
 #include <errno.h>
 #include <pthread.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/wait.h>
 
 #ifdef __APPLE__
 #include <iio/iio.h>
@@ -25,26 +27,46 @@
 #include <iio.h>
 #endif
 
-/* helper macros */
-#define MHZ(x) ((long long)(x*1000000.0 + .5))
-#define GHZ(x) ((long long)(x*1000000000.0 + .5))
-
-/* user config for testing purposes */
-#define FREQ1 MHZ(5)		// Frequency of 1st TX test sinusoidal
-#define NORUNS 10				// Number of times to run signal
-
-// Receive chain settings
-#define RX_BW MHZ(19.365)  // ~20 MHz rf bandwidth
-#define RX_FS MHZ(30.72) 	 // ~30.72 MS/s rx sample rate
-#define RX_LO GHZ(1)			 // 1 GHz rf frequency
-// Transmit chain settings
-#define TX_BW MHZ(19.365)
-#define TX_FS MHZ(30.72)
-#define TX_LO GHZ(1)
-// Buffer settings
-#define BUFFER_SIZE 1024*1024 //2097152 //16384 //1024*1024
-// FFT settings
-#define FFT_SIZE 1024*1024
+#include "dsp.h"
+#include "ringbuf.h"
+#include "convert.h"
+#include "fftplan.h"
+#include "welch.h"
+#include "db.h"
+#include "specfile.h"
+#include "recorder.h"
+#include "txwave.h"
+#include "nco.h"
+#include "noise.h"
+#include "source.h"
+#include "prof.h"
+#include "config.h"
+#include "sweep.h"
+#include "fastlock.h"
+#include "devattr.h"
+
+/*
+	 Source, frequencies, sizes and run count are runtime settings now, see
+	 config.c for the defaults and the built in profiles, -c and -C.
+*/
+// Transmit test signal settings
+#define TX_AMPL 32767			// peak amplitude of all tones together, in DAC codes
+#define TX_DITHER 16.0f		// peak TPDF dither added in stream mode, in DAC codes
+#define TX_CYCLIC_SAMPLES (1024*1024)	// power of two, tones snap to tx_fs / TX_CYCLIC_SAMPLES
+#define TX_BLOCK (256*1024)	// samples per TX push in stream mode
+#define TX_RING_BLOCKS 4		// prebuilt TX blocks queued ahead of the push thread
+// Sample settings
+#define ADC_BITS 12 		// AD9361 sample width
+// Spectrum output, read back with spec-dump
+#define SPEC_FILE "spectrum.spec"
+// Throughput mode, a read that returns this many block durations after the last one is late
+#define REFILL_LATE 1.5
+// Raw I/Q recording, 8 MiB per disk write is ~68 ms of samples at 30.72 MS/s
+#define REC_CHUNK (8*1024*1024)
+// Tuning, a throughput trial per setting, replaying a capture when there is no radio
+#define TUNE_SECONDS 2.0
+#define TUNE_MIN_BLOCKS 10	// fewer blocks per trial measure the start up, not the rate
+#define TUNE_STANDIN "iq.dat"
 
 /*
 	 Calculating the freq range per bin:
@@ -87,10 +109,53 @@ static struct iio_channel *rx0_i = NULL;
 static struct iio_channel *rx0_q = NULL;
 static struct iio_channel *tx0_i = NULL;
 static struct iio_channel *tx0_q = NULL;
+static struct iio_channel *rx_lo = NULL;
 static struct iio_buffer  *rxbuf = NULL;
 static struct iio_buffer  *txbuf = NULL;
+/* phy and LO settings, read back and written in batches by radio_init() */
+static struct devattr_set phy_attrs;
+
+static volatile bool stop;
+
+/* runtime settings: defaults, profile, config file, then the command line */
+static struct spectrum_config conf;
+
+/* capture ring between the RX thread and the DSP loop */
+static struct ringbuf rx_ring;
+static ssize_t rx_error;
+/* where RX samples come from: the radio, a file or a generator */
+static struct source rx_src;
+/* RX channel formats, used to convert ring blocks to FFT input */
+static struct iq_layout rx_layout;
+/* sources that don't run in real time wait for ring space instead of dropping */
+static bool rx_backpressure;
+/* raw I/Q recording fed by the capture thread, NULL when not recording */
+static struct recorder *rx_rec;
+/* sweep plan, the capture thread steps the LO through it when sweeping */
+static struct sweep sweep;
+static bool sweeping;
+static size_t sweep_settle;         // samples dropped after a retune for the PLL to settle
+/* AD9361 fastlock profiles of the sweep steps, rx_src hops with them when set */
+static struct fastlock fastlock;
 
-static bool stop;
+/*
+	 TX modes: cyclic hands one waveform to the hardware, which replays it
+	 on its own. Stream keeps generating: a generator thread fills a ring
+	 of blocks and tx_thread pushes them, so neither waits on the other
+	 and TX never waits on, or delays, RX.
+*/
+enum tx_mode { TX_OFF, TX_CYCLIC, TX_STREAM };
+static const char *const tx_modes[] = {
+	[TX_OFF]    = "off",
+	[TX_CYCLIC] = "cyclic",
+	[TX_STREAM] = "stream",
+};
+static struct ringbuf tx_ring;
+static struct nco tx_nco;
+static volatile bool tx_stop;
+static ssize_t tx_error;
+static atomic_uint_fast64_t tx_pushed;      // blocks handed to the DAC
+static atomic_uint_fast64_t tx_underflows;  // pushes with no block ready, sent as silence
 
 /* cleanup and exit */
 static void shutdown()
@@ -121,16 +186,16 @@ static void errchk(int v, const char* what) {
 	 if (v < 0) { fprintf(stderr, "Error %d writing to channel \"%s\"\nvalue may not be supported.\n", v, what); shutdown(); }
 }
 
-/* write attribute: long long int */
+/* queue attribute write: long long int, sent by devattr_commit() */
 static void wr_ch_lli(struct iio_channel *chn, const char* what, long long val)
 {
-	errchk(iio_channel_attr_write_longlong(chn, what, val), what);
+	errchk(devattr_lli(&phy_attrs, chn, what, val), what);
 }
 
-/* write attribute: string */
+/* queue attribute write: string */
 static void wr_ch_str(struct iio_channel *chn, const char* what, const char* str)
 {
-	errchk(iio_channel_attr_write(chn, what, str), what);
+	errchk(devattr_str(&phy_attrs, chn, what, str), what);
 }
 
 /* helper function generating channel names */
@@ -188,7 +253,7 @@ static bool get_lo_chan(struct iio_context *ctx, enum iodev d, struct iio_channe
 	}
 }
 
-/* applies streaming configuration through IIO */
+/* queues the streaming configuration, radio_init() commits it */
 bool cfg_ad9361_streaming_ch(struct iio_context *ctx, struct stream_cfg *cfg, enum iodev type, int chid)
 {
 	struct iio_channel *chn = NULL;
@@ -207,259 +272,1335 @@ bool cfg_ad9361_streaming_ch(struct iio_context *ctx, struct stream_cfg *cfg, en
 	return true;
 }
 
-// Demuxes incoming samples (convert to native format), currently not used
-static ssize_t demux_sample(const struct iio_channel *chn, void *sample, size_t size, void *d){
-	double val;
+/* opens the radio at uri, configures RX and TX and creates the RX buffer */
+static void radio_init(const char *uri, struct stream_cfg *rxcfg, struct stream_cfg *txcfg,
+		struct iio_device **rx, struct iio_device **tx)
+{
+	struct iio_channel *chn;
+	long long fs;
+	int ret;
+
+	printf("* Acquiring IIO context\n");
+	//ASSERT((ctx = iio_create_default_context()) && "No context");
+	ASSERT((ctx = iio_create_context_from_uri(uri)) && "No context");
+	ASSERT(iio_context_get_devices_count(ctx) > 0 && "No devices");
+
+	printf("* Acquiring AD9361 streaming devices\n");
+	ASSERT(get_ad9361_stream_dev(ctx, TX, tx) && "No tx dev found");
+	ASSERT(get_ad9361_stream_dev(ctx, RX, rx) && "No rx dev found");
+
+	printf("* Configuring AD9361 for streaming\n");
+	devattr_init(&phy_attrs);
+	ASSERT(cfg_ad9361_streaming_ch(ctx, rxcfg, RX, 0) && "RX port 0 not found");
+	ASSERT(cfg_ad9361_streaming_ch(ctx, txcfg, TX, 0) && "TX port 0 not found");
+	// only what differs from the device goes out, one round trip per channel where the backend can
+	ret = devattr_commit(&phy_attrs);
+	if (ret < 0)
+		errchk(ret, phy_attrs.failed->name);
+	devattr_report(stdout, &phy_attrs);
+
+	// the driver picks the nearest rate its clock chain can make, the rest of the run uses that one
+	ASSERT(get_phy_chan(ctx, RX, 0, &chn) && "RX phy chan not found");
+	ret = iio_channel_attr_read_longlong(chn, "sampling_frequency", &fs);
+	if (ret < 0)
+		errchk(ret, "sampling_frequency");
+	if (fs != rxcfg->fs_hz)
+		printf("* Sample rate %lld Hz, %lld Hz requested\n", fs, rxcfg->fs_hz);
+	rxcfg->fs_hz = txcfg->fs_hz = fs;
+
+	printf("* Initializing AD9361 IIO streaming channels\n");
+	ASSERT(get_ad9361_stream_ch(ctx, RX, *rx, 0, &rx0_i) && "RX chan i not found");
+	ASSERT(get_ad9361_stream_ch(ctx, RX, *rx, 1, &rx0_q) && "RX chan q not found");
+	ASSERT(get_ad9361_stream_ch(ctx, TX, *tx, 0, &tx0_i) && "TX chan i not found");
+	ASSERT(get_ad9361_stream_ch(ctx, TX, *tx, 1, &tx0_q) && "TX chan q not found");
+	ASSERT(get_lo_chan(ctx, RX, &rx_lo) && "RX LO chan not found");
+
+	printf("* Number of RX channels: %d\n", iio_device_get_channels_count(*rx));
+
+	printf("* Enabling IIO streaming channels\n");
+	iio_channel_enable(rx0_i);
+	iio_channel_enable(rx0_q);
+	iio_channel_enable(tx0_i);
+	iio_channel_enable(tx0_q);
+
+	// refills the kernel keeps queued while we are late, before it starts losing samples
+	ret = iio_device_set_kernel_buffers_count(*rx, conf.kernel_buffers);
+	if (ret < 0)
+		fprintf(stderr, "Could not set %u kernel buffers: %s\n", conf.kernel_buffers, strerror(-ret));
+	printf("* Creating non-cyclic RX buffer with %zu samples, %u kernel buffers\n", conf.buffer_size,
+		conf.kernel_buffers);
+	rxbuf = iio_device_create_buffer(*rx, conf.buffer_size, false);
+	if (!rxbuf) {
+		perror("Could not create RX buffer");
+		shutdown();
+	}
+}
+
+/*
+	 Sweep: moves the LO to the next step as soon as the current one is
+	 captured, so the synthesizer settles while the DSP loop still works
+	 on the previous step. Returns the samples to throw away before the
+	 next block is clean: what the source still holds from the old LO
+	 and the settling time.
+*/
+static ssize_t sweep_retune(unsigned int *lo_index)
+{
+	int ret;
+
+	*lo_index = (*lo_index + 1) % sweep.nsteps;
+	PROF_START(t_tune);
+	ret = source_tune(&rx_src, sweep.lo[*lo_index]);
+	PROF_END(PROF_TUNE, t_tune, 0);
+	return ret < 0 ? ret : ret + sweep_settle;
+}
+
+// Capture thread: only reads the sample source and publishes it into the ring
+static void *rx_thread(void *arg)
+{
+	struct ringbuf *rb = arg;
+	struct sample_block *blk;
+	struct source_block sb;
+	uint64_t seq = 0, last_read = 0;
+	unsigned int lo_index = 0;
+	ssize_t discard = 0;
+	size_t nbytes_rx;
+	int ret;
+
+	// start from the last step so the first retune lands on step 0
+	if (sweeping) {
+		lo_index = sweep.nsteps - 1;
+		discard = sweep_retune(&lo_index);
+		if (discard < 0) {
+			rx_error = discard;
+			stop = true;
+			return NULL;
+		}
+	}
+
+	while (!stop) {
+		PROF_START(t_read);
+		ret = source_read(&rx_src, &sb);
+		PROF_END(PROF_REFILL, t_read, ret > 0 ? ret : 0);
+		// a read long after the previous one: the radio's own buffers had to absorb it
+		if (prof_enabled && ret > 0 && !sweeping) {
+			uint64_t t = prof_now();
+
+			if (last_read && t - last_read > REFILL_LATE * ret * 1e9 / rx_src.fs_hz)
+				prof_count(PROF_LATE_REFILLS, 1);
+			last_read = t;
+		}
+		if (ret <= 0) {
+			if (ret < 0 && !stop) {
+				printf("Error refilling buf %d\n", ret);
+				rx_error = ret;
+			}
+			stop = true;
+			break;
+		}
+
+		// whole blocks until the samples from before the retune and the settling are gone
+		if (discard > 0) {
+			discard -= (ssize_t)sb.nsamples < discard ? (ssize_t)sb.nsamples : discard;
+			continue;
+		}
+
+		// record before the ring, blocks the DSP loop drops are still kept
+		if (rx_rec) {
+			PROF_START(t_rec);
+			recorder_write(rx_rec, (const char *)sb.data + sb.first, sb.nsamples,
+				sb.step, rx_layout.q_offset);
+			PROF_END(PROF_RECORD, t_rec, sb.nsamples);
+		}
+
+		// DSP is behind: the samples are lost, but keep draining the source
+		blk = rx_backpressure ? ringbuf_wait_free(rb, &stop) : ringbuf_acquire(rb);
+		if (!blk && stop)
+			break;
+		if (!blk) {
+			ringbuf_drop(rb, sb.nsamples);
+			prof_count(PROF_RX_DROPPED, sb.nsamples);
+			seq++;
+		} else {
+			PROF_START(t_ring);
+			nbytes_rx = sb.len < rb->block_size ? sb.len : rb->block_size;
+			memcpy(blk->data, sb.data, nbytes_rx);
+			blk->len = nbytes_rx;
+			blk->step = sb.step;
+			blk->first = sb.first;
+			blk->nsamples = nbytes_rx / sb.step;
+			blk->seq = seq++;
+			blk->lo_index = lo_index;
+			ringbuf_publish(rb);
+			PROF_END(PROF_RING, t_ring, blk->nsamples);
+		}
+
+		if (sweeping) {
+			discard = sweep_retune(&lo_index);
+			if (discard < 0) {
+				if (!stop) {
+					printf("Error retuning to %.0f Hz %d\n", sweep.lo[lo_index], (int)discard);
+					rx_error = discard;
+				}
+				stop = true;
+				break;
+			}
+		}
+	}
+	return NULL;
+}
+
+// TX generator: keeps the TX ring topped up with NCO blocks
+static void *tx_gen_thread(void *arg)
+{
+	struct ringbuf *rb = arg;
+	struct sample_block *blk;
+	struct noise dither;
+	uint64_t seq = 0;
+
+	noise_seed(&dither, 1);
+	while ((blk = ringbuf_wait_free(rb, &tx_stop))) {
+		PROF_START(t_gen);
+		nco_generate(&tx_nco, blk->data, TX_BLOCK);
+		noise_dither(&dither, blk->data, TX_BLOCK * 2, TX_DITHER);
+		blk->len = TX_BLOCK * 2 * sizeof(int16_t);
+		blk->nsamples = TX_BLOCK;
+		blk->step = 2 * sizeof(int16_t);
+		blk->first = 0;
+		blk->seq = seq++;
+		ringbuf_publish(rb);
+		PROF_END(PROF_TX_GEN, t_gen, TX_BLOCK);
+	}
+	return NULL;
+}
+
+// TX thread: pushes prebuilt blocks at the DAC's pace, never waits for the generator
+static void *tx_thread(void *arg)
+{
+	struct ringbuf *rb = arg;
+	struct sample_block *blk;
+
+	while (!tx_stop) {
+		ptrdiff_t p_inc = iio_buffer_step(txbuf);
+		char *p_dat = iio_buffer_first(txbuf, tx0_i);
+		char *p_end = iio_buffer_end(txbuf);
+		ssize_t nbytes_tx;
+		PROF_START(t_push);
+
+		blk = ringbuf_peek(rb);
+		if (!blk) {
+			// generator behind: keep the DAC fed with silence, never stall
+			atomic_fetch_add(&tx_underflows, 1);
+			prof_count(PROF_TX_UNDERFLOWS, 1);
+			memset(iio_buffer_start(txbuf), 0, p_end - (char *)iio_buffer_start(txbuf));
+		} else if (p_inc == blk->step) {
+			memcpy(p_dat, blk->data, p_end - p_dat < (ptrdiff_t)blk->len ? p_end - p_dat : blk->len);
+			ringbuf_release(rb);
+		} else {
+			const int16_t *iq = blk->data;
+
+			for (; p_dat < p_end; p_dat += p_inc, iq += 2) {
+				((int16_t *)p_dat)[0] = iq[0];
+				((int16_t *)p_dat)[1] = iq[1];
+			}
+			ringbuf_release(rb);
+		}
+
+		nbytes_tx = iio_buffer_push(txbuf);
+		if (nbytes_tx < 0) {
+			if (!tx_stop) {
+				printf("Error pushing buf %d\n", (int) nbytes_tx);
+				tx_error = nbytes_tx;
+			}
+			break;
+		}
+		atomic_fetch_add(&tx_pushed, 1);
+		PROF_END(PROF_TX_PUSH, t_push, (p_end - (char *)iio_buffer_start(txbuf)) / p_inc);
+	}
+	return NULL;
+}
+
+/* command line options */
+static bool plan_only;
+static const char *spec_path = SPEC_FILE;
+static const char *rec_path;
+static bool rec_direct;
+static enum tx_mode tx_mode = TX_CYCLIC;
+static bool src_fast;
+static double run_seconds;          // throughput mode: run this long instead of conf.runs frames
+static double prof_interval = -1;   // seconds between timing summaries, < 0 off
+static const char *prof_path;
+static const char *tune_path;       // tuning mode: recommended settings go here
+static const char *tune_rates;      // sample rates to tune for, comma separated, NULL for rx_fs
+static const char *tune_ffts;       // FFT sizes to tune for, NULL for fft_size
+static int tune_fd = -1;            // tuning trial: where throughput_report() sends its numbers
+
+enum { OPT_TUNE = 256, OPT_TUNE_RATES, OPT_TUNE_FFTS };
+
+static int tx_mode_parse(const char *str)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(tx_modes)/sizeof(tx_modes[0]); i++)
+		if (!strcmp(str, tx_modes[i]))
+			return i;
+	return -1;
+}
+
+static void usage(int argc, char *argv[])
+{
+	struct spectrum_config def;
+	const char *name, *desc;
+	unsigned int i;
+
+	config_default(&def);
+	printf("Usage: %s [OPTION]\n", argv[0]);
+	printf("  -c\tread settings from FILE, \"key = value\" lines, [PROFILE] sections only with -C\n");
+	printf("  -C\tprofile, a built in one or a [PROFILE] section of the -c file:\n");
+	for (i = 0; (name = config_profile_name(i, &desc)); i++)
+		printf("\t  %-11s%s\n", name, desc);
+	printf("  -x\tset any KEY=VALUE, keys: %s\n", config_keys());
+	printf("\t  sweep_start, sweep_stop: step the LO across this range and write one stitched\n"
+		"\t  spectrum per sweep, sweep_keep of each step's band is kept, sweep_settle seconds\n"
+		"\t  are dropped after each retune; needs a radio or a synth source (tone at FREQ Hz RF)\n"
+		"\t  fastlock: on a radio, calibrate every step once and hop between stored AD9361\n"
+		"\t  fastlock profiles, fastlock_settle seconds are dropped after those hops\n");
+	printf("  -X, --print-config\tprint the settings in effect as a config file and exit\n");
+	printf("  -s\tsample source (default %s):\n"
+		"\t  ip:HOST, usb:..., local:, iio:URI  radio through libiio\n"
+		"\t  raw:FILE   int16 I/Q pairs, e.g. a -r recording, fs/lo from FILE.meta\n"
+		"\t  text:FILE  \"I,Q\" or \"index I Q\" lines, e.g. input.csv, oscplot.csv, iq.dat\n"
+		"\t  synth[:FREQ[,NOISE]]  tone at FREQ Hz plus noise at NOISE dBFS\n"
+		"\t  loop[:KEY=VAL,...]  TX stream through the channel emulator, keys delay, gain,\n"
+		"\t             cfo, pn, noise, iqgain, iqphase, dci, dcq, bits, threads, seed\n"
+		"\t  FILE       raw or text, guessed from the content\n", def.source);
+	printf("  -A\treplay files as fast as possible instead of at the sample rate\n");
+	printf("  -l\tRX LO frequency in Hz, k/M/G suffixes (default %.0f)\n", def.rx_lo);
+	printf("  -S\tRX and TX sample rate in Hz (default %.0f)\n", def.rx_fs);
+	printf("  -F\t1st TX test tone in Hz (default %.0f)\n", def.freq1);
+	printf("  -n\tspectrum frames before exiting (default %u)\n", def.runs);
+	printf("  -b\tsamples per refill, k/M suffixes (default %zu)\n", def.buffer_size);
+	printf("  -f\tFFT size, k/M suffixes (default %zu)\n", def.fft_size);
+	printf("  -p\tFFT planner rigor: estimate, measure, patient, exhaustive (default %s)\n",
+		fftplan_rigor_name(def.rigor));
+	printf("  -w\tFFTW wisdom and window table cache directory (default ~/.cache/spectrum)\n");
+	printf("  -t\tFFT threads (default 0, one per CPU)\n");
+	printf("  -W\twindow: rect, hann, blackman-harris, flattop (default %s)\n",
+		welch_window_name(def.window));
+	printf("  -O\tsegment overlap, 0 to 0.95 (default %.2f)\n", def.overlap);
+	printf("  -L\tdB conversion: exact (libm log10) or fast (SIMD polynomial, < 0.0004 dB error) (default %s)\n",
+		db_mode_name(def.db_mode));
+	printf("  -o\tspectrum output file (default %s), see spec-dump\n", SPEC_FILE);
+	printf("  -r\trecord raw int16 I/Q to a file, metadata goes to FILE.meta\n");
+	printf("  -D\topen the recording with O_DIRECT\n");
+	printf("  -T\tTX test signal: off, cyclic (built once, replayed by the hardware)\n"
+		"\tor stream (generated continuously on its own threads) (default cyclic)\n");
+	printf("  -R\tthroughput mode: stream for SECONDS, then report sustained rate, real time factor,\n"
+		"\tgaps, lost samples and the limiting stage\n");
+	printf("  -M\ttime every pipeline stage, print a summary every SECONDS (0: only at exit)\n");
+	printf("  -m\ttime every pipeline stage, write a machine readable dump to FILE at exit\n");
+	printf("  -P, --plan-only\tplan the FFT, save the wisdom and exit without streaming\n");
+	printf("  --tune FILE\ttry every buffer_size and kernel_buffers for -R SECONDS each (default %.0f),\n"
+		"\tmeasure sustained rate, refill latency and drops, write the smallest lossless setting\n"
+		"\tper sample rate and FFT size to FILE as [tune-FS-FFT] sections for -c FILE -C;\n"
+		"\twithout a radio a replay of %s at each rate stands in\n", TUNE_SECONDS, TUNE_STANDIN);
+	printf("  --tune-rates LIST, --tune-ffts LIST\tcomma separated sample rates and FFT sizes\n"
+		"\tto tune for (default the -S rate and -f size)\n");
+}
+
+/* one setting from the command line, a bad value is fatal */
+static void set_option(int argc, char *argv[], const char *key, const char *value)
+{
+	if (config_set(&conf, key, value) < 0) {
+		fprintf(stderr, "Bad %s \"%s\"\n", key, value);
+		usage(argc, argv);
+		exit(1);
+	}
+}
+
+static void parse_options(int argc, char *argv[])
+{
+	static const struct option long_opts[] = {
+		{ "plan-only",    no_argument, NULL, 'P' },
+		{ "print-config", no_argument, NULL, 'X' },
+		{ "tune",         required_argument, NULL, OPT_TUNE },
+		{ "tune-rates",   required_argument, NULL, OPT_TUNE_RATES },
+		{ "tune-ffts",    required_argument, NULL, OPT_TUNE_FFTS },
+		{ "help",         no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 },
+	};
+	static const char *const opts = "c:C:x:Xs:Al:S:F:n:b:f:p:w:t:W:O:L:o:r:DT:R:M:m:Ph";
+	const char *conf_path = NULL, *profile = NULL;
+	bool print_config = false;
+	int c, ret;
+
+	// profile and config file first, whatever their position, the rest overrides them
+	opterr = 0;
+	while ((c = getopt_long(argc, argv, opts, long_opts, NULL)) != -1) {
+		if (c == 'c')
+			conf_path = optarg;
+		else if (c == 'C')
+			profile = optarg;
+	}
+	opterr = 1;
+	optind = 1;
+
+	config_default(&conf);
+	if (profile && config_profile(&conf, profile) < 0 && !conf_path) {
+		fprintf(stderr, "Unknown profile %s\n", profile);
+		exit(1);
+	}
+	if (conf_path) {
+		ret = config_load(&conf, conf_path, profile);
+		if (ret < 0) {
+			fprintf(stderr, "Could not load %s: %s\n", conf_path, strerror(-ret));
+			exit(1);
+		}
+		if (profile && strcmp(conf.profile, profile)) {
+			fprintf(stderr, "Unknown profile %s, not built in nor in %s\n", profile, conf_path);
+			exit(1);
+		}
+	}
+
+	while ((c = getopt_long(argc, argv, opts, long_opts, NULL)) != -1) {
+		switch (c)
+		{
+		case 'c':
+		case 'C':
+			break;
+		case 'x':
+			ret = config_set_pair(&conf, optarg);
+			if (ret < 0) {
+				fprintf(stderr, "%s setting \"%s\"\n",
+					ret == -ENOENT ? "Unknown" : "Bad", optarg);
+				usage(argc, argv);
+				exit(1);
+			}
+			break;
+		case 'X':
+			print_config = true;
+			break;
+		case 's':
+			set_option(argc, argv, "source", optarg);
+			break;
+		case 'A':
+			src_fast = true;
+			break;
+		case 'l':
+			set_option(argc, argv, "rx_lo", optarg);
+			break;
+		case 'S':
+			// one clock on the AD9361, RX and TX always run at the same rate
+			set_option(argc, argv, "rx_fs", optarg);
+			set_option(argc, argv, "tx_fs", optarg);
+			break;
+		case 'F':
+			set_option(argc, argv, "freq1", optarg);
+			break;
+		case 'n':
+			set_option(argc, argv, "runs", optarg);
+			break;
+		case 'b':
+			set_option(argc, argv, "buffer_size", optarg);
+			break;
+		case 'f':
+			set_option(argc, argv, "fft_size", optarg);
+			break;
+		case 'p':
+			set_option(argc, argv, "rigor", optarg);
+			break;
+		case 'w':
+			fftplan_set_cache_dir(optarg);
+			break;
+		case 't':
+			set_option(argc, argv, "fft_threads", optarg);
+			break;
+		case 'W':
+			set_option(argc, argv, "window", optarg);
+			break;
+		case 'O':
+			set_option(argc, argv, "overlap", optarg);
+			break;
+		case 'L':
+			set_option(argc, argv, "db_mode", optarg);
+			break;
+		case 'o':
+			spec_path = optarg;
+			break;
+		case 'r':
+			rec_path = optarg;
+			break;
+		case 'D':
+			rec_direct = true;
+			break;
+		case 'T':
+			if (tx_mode_parse(optarg) < 0) {
+				usage(argc, argv);
+				exit(1);
+			}
+			tx_mode = tx_mode_parse(optarg);
+			break;
+		case 'R':
+			run_seconds = atof(optarg);
+			if (run_seconds <= 0) {
+				usage(argc, argv);
+				exit(1);
+			}
+			prof_enable(true);
+			break;
+		case 'M':
+			prof_interval = atof(optarg);
+			prof_enable(true);
+			break;
+		case 'm':
+			prof_path = optarg;
+			prof_enable(true);
+			break;
+		case 'P':
+			plan_only = true;
+			break;
+		case OPT_TUNE:
+			tune_path = optarg;
+			break;
+		case OPT_TUNE_RATES:
+			tune_rates = optarg;
+			break;
+		case OPT_TUNE_FFTS:
+			tune_ffts = optarg;
+			break;
+		case 'h':
+		default:
+			usage(argc, argv);
+			exit(1);
+		}
+	}
+
+	if (print_config) {
+		printf("# spectrum settings%s%s\n", conf.profile[0] ? ", profile " : "", conf.profile);
+		config_write(stdout, &conf);
+		exit(0);
+	}
+}
+
+/*
+	 Throughput mode summary. Samples can go missing in three places: the
+	 capture ring (counted when the DSP loop is behind), between refills
+	 (the radio delivered less than fs * elapsed, libiio overflows are
+	 silent, paced replay counts what its kernel buffers would have lost)
+	 and as sequence gaps seen by the DSP loop. The stage with the
+	 largest share of wall time is the one to blame; source reads only
+	 count when they are real work, not waiting on the radio or the pacing.
+*/
+static void throughput_report(double elapsed, uint64_t nrx, uint64_t gaps, size_t frames)
+{
+	double rate = nrx / elapsed, rtf = rate / rx_src.fs_hz;
+	uint64_t ring_lost = atomic_load(&rx_ring.dropped_samples);
+	uint64_t shortfall = 0, lost;
+	enum prof_stage worst = PROF_NSTAGES;
+	uint64_t worst_ns = 0;
+	bool waits = rx_src.paced || source_is_iio(conf.source);
+	unsigned int i;
+
+	// allow for the blocks still in flight when the clock stopped, a sweep drops samples on purpose
+	if (source_is_iio(conf.source) && !sweeping) {
+		double expect = elapsed * rx_src.fs_hz - 2.0 * rx_src.block;
+
+		if (expect > rx_src.nread)
+			shortfall = expect - rx_src.nread;
+	} else if (!sweeping) {
+		shortfall = rx_src.overruns;
+	}
+	lost = ring_lost + shortfall;
+
+	for (i = 0; i < PROF_NSTAGES; i++) {
+		uint64_t ns = atomic_load(&prof_stats[i].total_ns);
+
+		if (i == PROF_FRAME || (i == PROF_REFILL && waits))
+			continue;
+		if (ns > worst_ns) {
+			worst_ns = ns;
+			worst = i;
+		}
+	}
+
+	printf("* Throughput over %.2f s: %.2f MS/s sustained, %.3fx real time (%.2f MS/s)\n",
+		elapsed, rate / 1e6, rtf, rx_src.fs_hz / 1e6);
+	printf("  %zu frames, %llu gaps, %llu samples lost (ring %llu, short refills %llu), "
+		"%llu late refills, %llu frame overruns\n", frames, (unsigned long long)gaps,
+		(unsigned long long)lost, (unsigned long long)ring_lost, (unsigned long long)shortfall,
+		(unsigned long long)atomic_load(&prof_counters[PROF_LATE_REFILLS]),
+		(unsigned long long)atomic_load(&prof_counters[PROF_OVERRUNS]));
+	if (sweeping && sweep.sweeps) {
+		uint64_t ntune = atomic_load(&prof_stats[PROF_TUNE].count);
+
+		printf("  %u sweeps of %u steps, %.1f ms per sweep, %.3f ms per step, retune %.1f us mean\n",
+			sweep.sweeps, sweep.nsteps, elapsed * 1e3 / sweep.sweeps,
+			elapsed * 1e3 / sweep.sweeps / sweep.nsteps,
+			ntune ? atomic_load(&prof_stats[PROF_TUNE].total_ns) / 1e3 / ntune : 0);
+	}
+	/*
+		 Tuning trial: rate, real time factor, drop rate, gaps, blocks still
+		 in the ring, refill latency mean and p99 in us. A short trial hides
+		 a slow DSP loop in a long ring, the backlog doesn't.
+	*/
+	if (tune_fd >= 0) {
+		const struct prof_stat *r = &prof_stats[PROF_REFILL];
+		uint64_t nrefill = atomic_load(&r->count);
+
+		dprintf(tune_fd, "%.0f %.6f %.9f %llu %u %.1f %.1f\n", rate, rtf,
+			lost / (elapsed * rx_src.fs_hz), (unsigned long long)gaps, ringbuf_fill(&rx_ring),
+			nrefill ? atomic_load(&r->total_ns) / 1e3 / nrefill : 0,
+			prof_percentile(r, 0.99) / 1e3);
+	}
+	if (worst == PROF_NSTAGES)
+		return;
+	printf("  %s: %s stage, %.1f%% of wall time, %.2f ns/sample\n",
+		lost || gaps || (rtf < 0.98 && !sweeping) ? "Fell behind, limited by" : "Kept up, busiest",
+		prof_stage_name(worst), worst_ns / 1e7 / elapsed,
+		atomic_load(&prof_stats[worst].samples) ?
+		(double)worst_ns / atomic_load(&prof_stats[worst].samples) : 0);
+}
+
+/*
+	 Tuning mode. Every buffer_size and kernel_buffers pair runs as a
+	 throughput trial in a child process, so each one starts from a fresh
+	 radio, ring and FFT plan exactly like a normal run; the child hands
+	 its numbers back on a pipe from throughput_report(). The capture ring
+	 keeps the duration of the configured one whatever the block size.
+	 Per sample rate and FFT size the least buffering that kept up without
+	 losing a sample is recommended, it is also the lowest latency.
+*/
+static const size_t tune_buffers[] = { 16*1024, 64*1024, 256*1024, 1024*1024, 4*1024*1024 };
+static const unsigned int tune_kbufs[] = { 2, 4, 8, 16 };
+
+#define TUNE_MAX_VALUES 16
+
+struct tune_trial {
+	size_t buffer_size;
+	unsigned int kernel_buffers;
+	unsigned int ring_blocks;
+	bool ok;                  // the child reported back
+	double rate;
+	double rtf;
+	double drop;              // fraction of the samples lost
+	unsigned long long gaps;
+	unsigned int backlog;     // ring blocks the DSP loop hadn't got to at the end
+	double refill_us;
+	double refill_p99_us;
+};
 
-	iio_channel_convert(chn, &val, sample);
+/*
+	 Real time sources count every lost sample and the DSP loop must not
+	 be more than a couple of blocks behind at the end, replay as fast as
+	 possible has to beat fs.
+*/
+static bool tune_kept_up(const struct tune_trial *t)
+{
+	return t->ok && !t->drop && !t->gaps && (src_fast ? t->rtf >= 1 : t->backlog <= 2);
+}
 
-	return size;
+/* lossless beats lossy, then less buffering among the lossless and fewer losses among the rest */
+static bool tune_better(const struct tune_trial *a, const struct tune_trial *b)
+{
+	if (tune_kept_up(a) != tune_kept_up(b))
+		return tune_kept_up(a);
+	if (tune_kept_up(a))
+		return a->buffer_size * a->kernel_buffers < b->buffer_size * b->kernel_buffers;
+	return a->drop < b->drop;
 }
 
-// Used by TX thread in generation of sine wave
-float dither(float f)
+/* base with key set to each item of a comma separated list, NULL for just base */
+static unsigned int tune_list(const struct spectrum_config *base, const char *key, const char *list,
+		struct spectrum_config *out)
 {
-	float r1 = (float)rand() / (float)RAND_MAX;
-	float r2 = (float)rand() / (float)RAND_MAX;
+	char item[64];
+	unsigned int n = 0;
+	size_t len;
 
-	return f + (r1 - r2) * 16.0f;
+	if (!list) {
+		out[0] = *base;
+		return 1;
+	}
+	while (*list) {
+		len = strcspn(list, ",");
+		if (n == TUNE_MAX_VALUES || len >= sizeof(item)) {
+			fprintf(stderr, "Too many or too long values in \"%s\"\n", list);
+			exit(1);
+		}
+		memcpy(item, list, len);
+		item[len] = '\0';
+		out[n] = *base;
+		if (config_set(&out[n], key, item) < 0) {
+			fprintf(stderr, "Bad %s \"%s\"\n", key, item);
+			exit(1);
+		}
+		n++;
+		list += len;
+		if (*list)
+			list++;
+	}
+	return n;
 }
 
-// Seperate thread for TX chain, currently not used
-void tx_thread(){
-	int16_t *buf, *sine;
-	int i;
+/* forks a trial with the settings in conf, true in the child, which goes on to stream */
+static bool tune_child(struct tune_trial *t)
+{
+	char line[256];
+	int fds[2], fd, status;
+	FILE *fp;
+	pid_t pid;
+
+	t->ok = false;
+	if (pipe(fds) < 0)
+		return false;
+	// the child would write out whatever is still buffered, the settings file included
+	fflush(NULL);
+	pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+	if (pid == 0) {
+		close(fds[0]);
+		tune_fd = fds[1];
+		fd = open("/dev/null", O_WRONLY);
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		return true;
+	}
 
-	sine = malloc(sizeof(int16_t) * 1024 * 256 * 2);
+	close(fds[1]);
+	fp = fdopen(fds[0], "r");
+	if (fp) {
+		t->ok = fgets(line, sizeof(line), fp) && sscanf(line, "%lf %lf %lf %llu %u %lf %lf",
+			&t->rate, &t->rtf, &t->drop, &t->gaps, &t->backlog, &t->refill_us,
+			&t->refill_p99_us) == 7;
+		fclose(fp);
+	} else {
+		close(fds[0]);
+	}
+	waitpid(pid, &status, 0);
+	return false;
+}
+
+/* size with a k or M suffix where it divides, as the config keys take it */
+static const char *tune_size_name(char *buf, size_t len, size_t n)
+{
+	if (n % (1024*1024) == 0)
+		snprintf(buf, len, "%zuM", n / (1024*1024));
+	else if (n % 1024 == 0)
+		snprintf(buf, len, "%zuk", n / 1024);
+	else
+		snprintf(buf, len, "%zu", n);
+	return buf;
+}
+
+/* runs the trials and writes tune_path, returns only in the trial children */
+static void tune(void)
+{
+	static const char *const keys[] = { "rx_fs", "tx_fs", "fft_size", "buffer_size", "kernel_buffers",
+		"ring_blocks", NULL };
+	struct spectrum_config base = conf;
+	struct spectrum_config rates[TUNE_MAX_VALUES], ffts[TUNE_MAX_VALUES];
+	struct tune_trial trials[sizeof(tune_buffers)/sizeof(tune_buffers[0]) *
+		sizeof(tune_kbufs)/sizeof(tune_kbufs[0])], *t, *best;
+	unsigned int nrates, nffts, ntrials, i, j, b, k;
+	char fftname[16], bufname[16];
+	struct iio_context *probe;
+	FILE *fp;
+
+	nrates = tune_list(&base, "rx_fs", tune_rates, rates);
+	nffts = tune_list(&base, "fft_size", tune_ffts, ffts);
+	fp = fopen(tune_path, "w");
+	if (!fp) {
+		fprintf(stderr, "Could not create %s: %s\n", tune_path, strerror(errno));
+		exit(1);
+	}
 
-	for (i = 0; i < 1024 * 256; i++) {
-		sine[i*2 + 0] = dither(cos(2 * M_PI * i / 256.0) * 0x4000);
-		sine[i*2 + 1] = dither(sin(2 * M_PI * i / 256.0) * 0x4000);
+	// no radio to tune against: a paced replay of a capture behaves like one at any rate
+	if (source_is_iio(base.source)) {
+		probe = iio_create_context_from_uri(strncmp(base.source, "iio:", 4) ?
+			base.source : base.source + 4);
+		if (probe) {
+			iio_context_destroy(probe);
+		} else {
+			printf("* No radio at %s, tuning on a paced replay of %s\n", base.source, TUNE_STANDIN);
+			snprintf(base.source, sizeof(base.source), "%s", TUNE_STANDIN);
+			src_fast = false;
+		}
 	}
 
-	while (1) {
-		buf = iio_buffer_start(txbuf);
-		memcpy(buf, sine, 1024 * 256 * sizeof(int16_t) * 2);
-		iio_buffer_push(txbuf);
+	fprintf(fp, "# spectrum tuning on %s, %.1f s per trial\n"
+		"# least buffering without lost samples per sample rate and FFT size,\n"
+		"# use with -c %s -C tune-FS-FFT\n", base.source, run_seconds, tune_path);
+	for (i = 0; i < nrates; i++) {
+		for (j = 0; j < nffts; j++) {
+			tune_size_name(fftname, sizeof(fftname), ffts[j].fft_size);
+			printf("* Tuning for %.3f MS/s, %s point FFT\n", rates[i].rx_fs / 1e6, fftname);
+			ntrials = 0;
+			for (b = 0; b < sizeof(tune_buffers)/sizeof(tune_buffers[0]); b++) {
+				// shorter blocks finish a segment only every few refills, the frames are no lighter
+				if (tune_buffers[b] < ffts[j].fft_size) {
+					printf("  buffer %5s: skipped, shorter than the FFT\n",
+						tune_size_name(bufname, sizeof(bufname), tune_buffers[b]));
+					continue;
+				}
+				if (tune_buffers[b] * TUNE_MIN_BLOCKS > run_seconds * rates[i].rx_fs) {
+					printf("  buffer %5s: skipped, fewer than %d blocks in %.1f s\n",
+						tune_size_name(bufname, sizeof(bufname), tune_buffers[b]),
+						TUNE_MIN_BLOCKS, run_seconds);
+					continue;
+				}
+				for (k = 0; k < sizeof(tune_kbufs)/sizeof(tune_kbufs[0]); k++) {
+					// replay as fast as possible never waits, kernel buffers don't come into it
+					if (src_fast && !source_is_iio(base.source) && k)
+						break;
+					t = &trials[ntrials++];
+					t->buffer_size = tune_buffers[b];
+					t->kernel_buffers = src_fast && !source_is_iio(base.source) ?
+						base.kernel_buffers : tune_kbufs[k];
+					t->ring_blocks = 2;
+					while (t->ring_blocks < 4096 && (size_t)t->ring_blocks * t->buffer_size <
+						(size_t)base.ring_blocks * base.buffer_size)
+						t->ring_blocks *= 2;
+
+					conf = base;
+					conf.rx_fs = conf.tx_fs = rates[i].rx_fs;
+					conf.fft_size = ffts[j].fft_size;
+					conf.buffer_size = t->buffer_size;
+					conf.kernel_buffers = t->kernel_buffers;
+					conf.ring_blocks = t->ring_blocks;
+					if (tune_child(t))
+						return;
+
+					printf("  buffer %5s x %2u, ring %4u: ",
+						tune_size_name(bufname, sizeof(bufname), t->buffer_size),
+						t->kernel_buffers, t->ring_blocks);
+					if (!t->ok)
+						printf("failed\n");
+					else
+						printf("%7.2f MS/s, %.3fx, %.4f%% lost, %llu gaps, %u behind, refill %.1f us "
+							"mean, %.1f us p99\n", t->rate / 1e6, t->rtf, t->drop * 100, t->gaps,
+							t->backlog, t->refill_us, t->refill_p99_us);
+				}
+			}
+
+			best = NULL;
+			for (t = trials; t < trials + ntrials; t++)
+				if (t->ok && (!best || tune_better(t, best)))
+					best = t;
+			if (!best) {
+				printf("* No trial completed for %.3f MS/s, %s point FFT\n", rates[i].rx_fs / 1e6,
+					fftname);
+				continue;
+			}
+
+			conf = base;
+			conf.rx_fs = conf.tx_fs = rates[i].rx_fs;
+			conf.fft_size = ffts[j].fft_size;
+			conf.buffer_size = best->buffer_size;
+			conf.kernel_buffers = best->kernel_buffers;
+			conf.ring_blocks = best->ring_blocks;
+			printf("* Recommended: buffer_size %s, kernel_buffers %u, %.1f ms buffered%s\n",
+				tune_size_name(bufname, sizeof(bufname), best->buffer_size), best->kernel_buffers,
+				best->buffer_size * best->kernel_buffers * 1e3 / conf.rx_fs,
+				tune_kept_up(best) ? "" : ", none kept up");
+			fprintf(fp, "\n# %.2f MS/s sustained, %.4f%% lost, refill %.1f us mean, %.1f us p99\n"
+				"[tune-%gM-%s]\n", best->rate / 1e6, best->drop * 100, best->refill_us,
+				best->refill_p99_us, conf.rx_fs / 1e6, fftname);
+			config_write_keys(fp, &conf, keys);
+		}
 	}
+	if (fclose(fp))
+		fprintf(stderr, "Error writing %s: %s\n", tune_path, strerror(errno));
+	else
+		printf("* Settings written to %s\n", tune_path);
+	exit(0);
 }
 
 /* main entry point */
 int main (int argc, char **argv)
 {
-	// TX thread
-	//pthread_t tx_th;
-	//int thread_info;
-	//void *res;
-	int cnt, count;
+	// TX generator and push threads, stream mode only
+	pthread_t tx_gen_th, tx_th;
+	// RX capture thread
+	pthread_t rx_th;
+	struct sample_block *blk;
+	uint64_t next_seq = 0, gaps = 0;
+	int count;
 
 	// File to dump data
-	FILE *fp1, *fp2;
-	FILE *fp3;
-	char buf[0x100]; // hold filename
+	char buf[0x100];
+	struct specfile spec;
+	struct spec_header spec_hdr;
+	struct recorder rec;
+	struct recorder_meta rec_meta;
+	struct txwave txw;
+	double tx_freq[2];
+	double tx_ampl[2];
+	unsigned int tx_tones;
+	unsigned int tone;
+	uint32_t spec_flags = 0;
+	uint64_t frame_seq = 0;
+	size_t frame_samples, frame_blocks = 0, frame_nseg = 0;
+	unsigned int frame_lo;
+	bool frame_done;
+	uint64_t sweep_last;
+	uint64_t prof_start, prof_last, run_ns;
+	int ret;
 
 	// Streaming devices
 	struct iio_device *tx;
 	struct iio_device *rx;
 
-	// RX and TX sample counters
+	// RX sample counter
 	size_t nrx = 0;
-	size_t ntx = 0;
 
 	// Stream configurations
 	struct stream_cfg rxcfg;
 	struct stream_cfg txcfg;
 
 	ssize_t fft_size;
-	fftw_complex *in, *out;
-	fftw_plan plan;
-	double mag;
-	double *out_data;
-	double *out_freq;
+	struct welch psd;
+	struct plan_info pinfo;
+	size_t nseg, done, n;
+	double rx_scale;
+	sample_t *psd_data;
+
+	parse_options(argc, argv);
+	if (tune_path) {
+		// each trial is a child process that comes back here and streams as a normal run
+		if (run_seconds <= 0)
+			run_seconds = TUNE_SECONDS;
+		tune();
+		spec_path = "/dev/null";
+		prof_enable(true);
+		prof_interval = -1;
+		prof_path = NULL;
+	}
+	rx_scale = conf.dbfs ? convert_scale_dbfs(ADC_BITS) : 1.0;
+	tx_freq[0] = conf.freq1;
+	tx_freq[1] = conf.freq2;
+	tx_tones = conf.freq2 ? 2 : 1;
 
 	// Listen to ctrl+c and ASSERT
 	signal(SIGINT, handle_sig);
 
+	// configure the Welch PSD, before touching the radio as planning may take a while
+	fft_size = conf.fft_size;
+	psd_data = malloc(sizeof(sample_t)*fft_size);
+	fftplan_set_threads(conf.fft_threads);
+	if (conf.profile[0])
+		printf("* Profile: %s\n", conf.profile);
+	printf("* Power kernel: %s, %s dB\n", db_init(), db_mode_name(conf.db_mode));
+	printf("* Planning %zd point %s precision FFT of %zu sample blocks, %s window, %.0f%% overlap (%s)\n",
+		fft_size, PRECISION_NAME, conf.buffer_size, welch_window_name(conf.window),
+		conf.overlap * 100, fftplan_rigor_name(conf.rigor));
+	ASSERT(welch_init(&psd, fft_size, conf.overlap, conf.window, conf.buffer_size,
+		conf.rigor, &pinfo) == 0 && "FFT planning failed");
+	printf("* FFT plan for %zu segments %s in %.2f s on %d threads%s, window table %s\n"
+		"  Wisdom: %s\n", psd.nseg, pinfo.from_wisdom ? "loaded from wisdom" :
+		conf.rigor == PLAN_ESTIMATE ? "estimated" : "measured", pinfo.seconds,
+		pinfo.threads, pinfo.saved ? ", wisdom saved" : "",
+		psd.win_cached ? "cached" : "computed", pinfo.path);
+	printf("* IQ conversion kernel: %s\n", convert_init());
+
+	if (plan_only) {
+		welch_free(&psd);
+		free(psd_data);
+		return 0;
+	}
+
 	// RX stream config
-	rxcfg.bw_hz = RX_BW;
-	rxcfg.fs_hz = RX_FS;
-	rxcfg.lo_hz = RX_LO;
+	rxcfg.bw_hz = llround(conf.rx_bw);
+	rxcfg.fs_hz = llround(conf.rx_fs);
+	rxcfg.lo_hz = llround(conf.rx_lo);
 	rxcfg.rfport = "A_BALANCED"; // port A (select for rf freq.)
 
-	// Print some device information
-	printf("*RX settings\n  Bandwidth: %lld Hz\n  Baseband Sample rate: %lld Hz\n  LO frequency: %lld Hz\n", rxcfg.bw_hz, rxcfg.fs_hz, rxcfg.lo_hz);
-
 	// TX stream config
-	txcfg.bw_hz = TX_BW;
-	txcfg.fs_hz = TX_FS;
-	txcfg.lo_hz = TX_LO;
+	txcfg.bw_hz = llround(conf.tx_bw);
+	txcfg.fs_hz = llround(conf.tx_fs);
+	txcfg.lo_hz = llround(conf.tx_lo);
 	txcfg.rfport = "A"; // port A (select for rf freq.)
 
-	printf("* Acquiring IIO context\n");
-	//ASSERT((ctx = iio_create_default_context()) && "No context");
-	ASSERT((ctx = iio_create_network_context("192.168.1.227")) && "No context");
-	ASSERT(iio_context_get_devices_count(ctx) > 0 && "No devices");
-
-	printf("* Acquiring AD9361 streaming devices\n");
-	ASSERT(get_ad9361_stream_dev(ctx, TX, &tx) && "No tx dev found");
-	ASSERT(get_ad9361_stream_dev(ctx, RX, &rx) && "No rx dev found");
-
-	printf("* Configuring AD9361 for streaming\n");
-	ASSERT(cfg_ad9361_streaming_ch(ctx, &rxcfg, RX, 0) && "RX port 0 not found");
-	ASSERT(cfg_ad9361_streaming_ch(ctx, &txcfg, TX, 0) && "TX port 0 not found");
-
-	printf("* Initializing AD9361 IIO streaming channels\n");
-	ASSERT(get_ad9361_stream_ch(ctx, RX, rx, 0, &rx0_i) && "RX chan i not found");
-	ASSERT(get_ad9361_stream_ch(ctx, RX, rx, 1, &rx0_q) && "RX chan q not found");
-	ASSERT(get_ad9361_stream_ch(ctx, TX, tx, 0, &tx0_i) && "TX chan i not found");
-	ASSERT(get_ad9361_stream_ch(ctx, TX, tx, 1, &tx0_q) && "TX chan q not found");
-
-	printf("* Number of RX channels: %d\n", iio_device_get_channels_count(rx));
+	printf("* NCO kernel: %s, noise kernel: %s\n", nco_init(), noise_init());
+	if (source_is_iio(conf.source)) {
+		if (rxcfg.fs_hz != txcfg.fs_hz) {
+			fprintf(stderr, "rx_fs %lld and tx_fs %lld differ, the AD9361 runs both from one clock\n",
+				rxcfg.fs_hz, txcfg.fs_hz);
+			shutdown();
+		}
+		radio_init(strncmp(conf.source, "iio:", 4) ? conf.source : conf.source + 4, &rxcfg, &txcfg, &rx, &tx);
+		source_open_iio(&rx_src, rxbuf, rx0_i, rx0_q, rx_lo, conf.buffer_size, rxcfg.fs_hz,
+			rxcfg.lo_hz, rxcfg.bw_hz);
+	} else if (source_is_loopback(conf.source)) {
+		ret = source_open_loopback(&rx_src, &tx_ring, conf.source, conf.buffer_size, rxcfg.fs_hz, !src_fast);
+		if (ret < 0) {
+			fprintf(stderr, "Could not open source %s: %s\n", conf.source, strerror(-ret));
+			shutdown();
+		}
+		// the TX stream is the input, the source takes the place of the push thread
+		tx_mode = TX_STREAM;
+	} else {
+		ret = source_open(&rx_src, conf.source, conf.buffer_size, rxcfg.fs_hz, !src_fast);
+		if (ret < 0) {
+			fprintf(stderr, "Could not open source %s: %s\n", conf.source, strerror(-ret));
+			shutdown();
+		}
+		// no radio, nothing to transmit on
+		tx_mode = TX_OFF;
+	}
+	rx_src.kernel_buffers = conf.kernel_buffers;
+	rx_backpressure = !source_is_iio(conf.source) && !rx_src.paced;
+	printf("* Sample source: %s%s\n", rx_src.desc, source_is_iio(conf.source) ? "" :
+		src_fast ? ", as fast as possible" : ", paced to the sample rate");
+
+	// Sweep: one block per step, so a segment has to fit in a block
+	sweeping = conf.sweep_stop > 0;
+	if (sweeping) {
+		double settle;
+
+		if ((size_t)fft_size > conf.buffer_size || rec_path) {
+			fprintf(stderr, "Sweeping needs fft_size <= buffer_size and no recording\n");
+			shutdown();
+		}
+		ret = sweep_init(&sweep, conf.sweep_start, conf.sweep_stop, rx_src.fs_hz, fft_size,
+			conf.sweep_keep);
+		if (ret < 0) {
+			fprintf(stderr, "Could not plan sweep %.0f to %.0f Hz: %s\n", conf.sweep_start,
+				conf.sweep_stop, strerror(-ret));
+			shutdown();
+		}
+		ret = source_tune(&rx_src, sweep.lo[0]);
+		if (ret < 0) {
+			fprintf(stderr, "Source %s can't sweep: %s\n", rx_src.desc, strerror(-ret));
+			shutdown();
+		}
+		// a calibration per step once, then every hop is a profile recall
+		settle = conf.sweep_settle;
+		if (conf.fastlock && rx_src.lo_chn) {
+			ret = fastlock_init(&fastlock, rx_src.lo_chn, sweep.lo, sweep.nsteps);
+			if (ret < 0) {
+				printf("* Fastlock not available (%s), retuning by frequency\n", strerror(-ret));
+			} else {
+				rx_src.fastlock = &fastlock;
+				settle = conf.fastlock_settle;
+				printf("* Fastlock: %u profiles calibrated in %.1f ms, %u resident in the %d slots\n",
+					fastlock.nprof, fastlock.init_seconds * 1e3,
+					fastlock.nprof < FASTLOCK_SLOTS ? fastlock.nprof : FASTLOCK_SLOTS, FASTLOCK_SLOTS);
+			}
+		}
+		sweep_settle = ceil(settle * rx_src.fs_hz);
+		// the LO is ours to wait on, a step is worth more than real time
+		rx_backpressure = true;
+		printf("* Sweeping %.3f to %.3f MHz: %u steps of %.3f MHz, %zu of %zd bins kept, "
+			"%.0f us settling\n", sweep.start_hz / 1e6, (sweep.start_hz + sweep.span_hz) / 1e6,
+			sweep.nsteps, sweep.step_hz / 1e6, sweep.nkeep, fft_size, settle * 1e6);
+	}
 
-	printf("* Enabling IIO streaming channels\n");
-	iio_channel_enable(rx0_i);
-	iio_channel_enable(rx0_q);
-	iio_channel_enable(tx0_i);
-	iio_channel_enable(tx0_q);
+	// Print some device information
+	printf("*RX settings\n  Bandwidth: %.0f Hz\n  Baseband Sample rate: %.0f Hz\n  LO frequency: %.0f Hz\n",
+		rx_src.bw_hz, rx_src.fs_hz, rx_src.lo_hz);
+
+	tx_ampl[0] = tx_ampl[1] = TX_AMPL / tx_tones;
+	memset(&txw, 0, sizeof(txw));
+	if (tx_mode == TX_CYCLIC) {
+		// TX test tones, built once by the NCO and replayed by the hardware from a cyclic buffer
+		if (txwave_tones(&txw, txcfg.fs_hz, tx_freq, tx_ampl, tx_tones, TX_CYCLIC_SAMPLES) < 0) {
+			perror("Could not build TX waveform");
+			shutdown();
+		}
+		printf("* Creating cyclic TX buffer with %zu samples, tones at %.3f Hz",
+			txw.nsamples, txw.freq_hz[0]);
+		if (txw.ntones > 1)
+			printf(" and %.3f Hz", txw.freq_hz[1]);
+		printf("\n");
+		txbuf = iio_device_create_buffer(tx, txw.nsamples, true);
+		if (!txbuf) {
+			perror("Could not create TX buffer");
+			shutdown();
+		}
+		txwave_load(&txw, txbuf, tx0_i);
+		if (iio_buffer_push(txbuf) < 0) {
+			perror("Could not push TX buffer");
+			shutdown();
+		}
+	} else if (tx_mode == TX_STREAM) {
+		// Same tones generated continuously, the phase carries across blocks
+		nco_reset(&tx_nco, txcfg.fs_hz);
+		for (tone = 0; tone < tx_tones; tone++)
+			nco_add_tone(&tx_nco, tx_freq[tone], tx_ampl[tone]);
+		if (ctx) {
+			printf("* Creating non-cyclic TX buffer with %d samples, %d block ring\n",
+				TX_BLOCK, TX_RING_BLOCKS);
+			txbuf = iio_device_create_buffer(tx, TX_BLOCK, false);
+			if (!txbuf) {
+				perror("Could not create TX buffer");
+				shutdown();
+			}
+		}
+		if (ringbuf_init(&tx_ring, TX_RING_BLOCKS, TX_BLOCK * 2 * sizeof(int16_t)) < 0) {
+			perror("Could not allocate TX ring");
+			shutdown();
+		}
+	}
 
-	int buffer_size = BUFFER_SIZE;
+	// Sample format of the RX channels, e.g. le:S12/16>>0, native int16 for files
+	rx_layout = rx_src.layout;
+	printf("* RX format: I %s, Q %s%s\n",
+		convert_format_str(&rx_layout.fmt_i, tmpstr, sizeof(tmpstr)),
+		convert_format_str(&rx_layout.fmt_q, buf, sizeof(buf)),
+		rx_layout.packed ? " (packed)" : "");
 
-	printf("* Creating non-cyclic IIO buffers with 1 MiS\n");
-	rxbuf = iio_device_create_buffer(rx, buffer_size, false);
-	if (!rxbuf) {
-		perror("Could not create RX buffer");
+	printf("* Allocating capture ring of %u blocks\n", conf.ring_blocks);
+	if (ringbuf_init(&rx_ring, conf.ring_blocks, conf.buffer_size * rx_src.sample_size) < 0) {
+		perror("Could not allocate capture ring");
 		shutdown();
 	}
-	txbuf = iio_device_create_buffer(tx, buffer_size, false);
-	if (!txbuf) {
-		perror("Could not create TX buffer");
+
+	// Spectrum file, the frequency axis is implied by fs and nfft, a sweep is one wide spectrum
+	memset(&spec_hdr, 0, sizeof(spec_hdr));
+	spec_hdr.nfft = sweeping ? sweep.nbins : (size_t)fft_size;
+	spec_hdr.fs_hz = sweeping ? sweep.span_hz : rx_src.fs_hz;
+	spec_hdr.lo_hz = sweeping ? sweep.centre_hz : rx_src.lo_hz;
+	spec_hdr.bw_hz = sweeping ? sweep.span_hz : rx_src.bw_hz;
+	spec_hdr.overlap = conf.overlap;
+	spec_hdr.enbw = welch_enbw(&psd);
+	snprintf(spec_hdr.window, sizeof(spec_hdr.window), "%s", welch_window_name(conf.window));
+	snprintf(spec_hdr.db_mode, sizeof(spec_hdr.db_mode), "%s", db_mode_name(conf.db_mode));
+	ret = specfile_create(&spec, spec_path, &spec_hdr);
+	if (ret < 0) {
+		fprintf(stderr, "Could not create %s: %s\n", spec_path, strerror(-ret));
 		shutdown();
 	}
-
-	// configure fft
-  fft_size = FFT_SIZE;
-	in = (fftw_complex*) fftw_malloc(sizeof(fftw_complex)*fft_size);
-	out = (fftw_complex*) fftw_malloc(sizeof(fftw_complex)*fft_size);
-	out_data = malloc(sizeof(double)*fft_size);
-	out_freq = malloc(sizeof(double)*fft_size);
-	plan = fftw_plan_dft_1d(fft_size, in, out, FFTW_FORWARD, FFTW_ESTIMATE);
+	printf("* Writing spectrum frames to %s\n", spec_path);
+
+	if (rec_path) {
+		memset(&rec_meta, 0, sizeof(rec_meta));
+		rec_meta.fs_hz = rx_src.fs_hz;
+		rec_meta.lo_hz = rx_src.lo_hz;
+		rec_meta.bw_hz = rx_src.bw_hz;
+		convert_format_str(&rx_layout.fmt_i, rec_meta.format, sizeof(rec_meta.format));
+		ret = recorder_open(&rec, rec_path, REC_CHUNK, rec_direct, &rec_meta);
+		if (ret < 0) {
+			fprintf(stderr, "Could not create %s: %s\n", rec_path, strerror(-ret));
+			shutdown();
+		}
+		rx_rec = &rec;
+		printf("* Recording raw I/Q to %s%s\n", rec_path,
+			rec.direct ? " (O_DIRECT)" : rec_direct ? " (O_DIRECT refused, buffered)" : "");
+	}
 
 	printf("* Starting IO streaming (press CTRL+C to cancel)\n");
 
 
-	// Create TX thread
-	//pthread_create (&tx_th, NULL, (void*) &tx_thread, NULL);
-	count = NORUNS;
+	// Create TX threads, and let the generator fill the ring before the first push
+	if (tx_mode == TX_STREAM) {
+		if (pthread_create(&tx_gen_th, NULL, tx_gen_thread, &tx_ring)) {
+			perror("Could not create TX generator thread");
+			shutdown();
+		}
+		while (ringbuf_fill(&tx_ring) < tx_ring.count)
+			usleep(1000);
+		if (txbuf && pthread_create(&tx_th, NULL, tx_thread, &tx_ring)) {
+			perror("Could not create TX thread");
+			shutdown();
+		}
+	}
+	count = conf.runs;
+	prof_start = prof_last = sweep_last = prof_now();
+	if (run_seconds > 0)
+		printf("* Throughput mode, streaming for %.1f s\n", run_seconds);
+
+	// Create RX capture thread, the loop below is the DSP consumer
+	if (pthread_create(&rx_th, NULL, rx_thread, &rx_ring)) {
+		perror("Could not create RX thread");
+		shutdown();
+	}
 
-fp2 = fopen("input.csv", "w+");
-	while (!stop && count > 0){
-		ssize_t nbytes_rx, nbytes_tx;
-		char *p_dat, *p_end;
+	while (!stop && (run_seconds > 0 ? prof_now() - prof_start < run_seconds * 1e9 : count > 0)) {
 		ptrdiff_t p_inc;
 
-		// Schedule TX buffer
-		nbytes_tx = iio_buffer_push(txbuf);
-		if (nbytes_tx < 0) { printf("Error pushing buf %d\n", (int) nbytes_tx); shutdown(); }
-
-		// Refill RX buffer
-		nbytes_rx = iio_buffer_refill(rxbuf);
-		if (nbytes_rx < 0) { printf("Error refilling buf %d\n",(int) nbytes_rx); shutdown(); }
-
-		// READ: Get pointers to RX buf and read IQ from RX buf port 0
-
-		p_inc = iio_buffer_step(rxbuf);
-		p_end = iio_buffer_end(rxbuf);
-
-		// Convert to native format
-		iio_buffer_foreach_sample(rxbuf, demux_sample, NULL);
+		// Wait for the capture thread to publish an RX block
+		blk = ringbuf_wait(&rx_ring, &stop);
+		if (!blk) { break; }
+		if (blk->seq != next_seq) {
+			gaps += blk->seq - next_seq;
+			spec_flags |= SPEC_FRAME_GAP;
+			prof_count(PROF_RX_GAPS, blk->seq - next_seq);
+		}
+		next_seq = blk->seq + 1;
+		if (frame_blocks++ == 0)
+			frame_seq = blk->seq;
+		frame_samples = blk->nsamples;
+		frame_lo = blk->lo_index;
+		PROF_START(t_frame);
+
+		// every sweep step is a spectrum of its own, nothing carries over from the last LO
+		if (sweeping)
+			welch_reset(&psd);
+
+		// READ: Get pointers to the RX block and read IQ from RX port 0
+		p_inc = blk->step;
+
+		// Convert captured data to native values straight into the Welch
+		// staging buffer, one bulk pass, segments are transformed as they complete
+		for (done = 0; done < blk->nsamples; done += n) {
+			size_t space;
+			fft_complex *dst = welch_input(&psd, &space);
+
+			n = blk->nsamples - done < space ? blk->nsamples - done : space;
+			PROF_START(t_conv);
+			convert_iq(&rx_layout, dst, n, (char *)blk->data + blk->first + done * p_inc,
+				n, p_inc, rx_scale);
+			PROF_END(PROF_CONVERT, t_conv, n);
+			PROF_START(t_fft);
+			welch_commit(&psd, n);
+			PROF_END(PROF_FFT, t_fft, n);
+		}
 
+		nrx += blk->nsamples;
+		ringbuf_release(&rx_ring);
+
+		// Average of all segments since the last frame, in dB, DC centred
+		PROF_START(t_flush);
+		welch_flush(&psd);
+		PROF_END(PROF_FFT, t_flush, 0);
+		PROF_START(t_db);
+		nseg = welch_average_db(&psd, psd_data, conf.db_mode);
+		PROF_END(PROF_DB, t_db, fft_size);
+		frame_nseg += nseg;
+
+		// Blocks shorter than the FFT may finish no segment, the frame goes on until one does.
+		// A sweep is written once its last step is in, the kept centres stitched together
+		frame_done = nseg > 0;
+		if (sweeping) {
+			PROF_START(t_stitch);
+			frame_done = sweep_add(&sweep, frame_lo, psd_data);
+			PROF_END(PROF_DB, t_stitch, sweep.nkeep);
+			if (frame_done && sweep.missing)
+				spec_flags |= SPEC_FRAME_GAP;
+		}
 
-		// Dump received data to file for analysis
-		cnt = 0;
-		for (p_dat = (char *)iio_buffer_first(rxbuf, rx0_i); p_dat < p_end; p_dat += p_inc) {
-			// Get I and Q and save to file
-			const int16_t i = ((int16_t*)p_dat)[0]; // Real (I)
-			const int16_t q = ((int16_t*)p_dat)[1]; // Imag (Q)
+		// Sample counter increment and status output, a summary at the end in throughput mode
+		if (frame_done && run_seconds <= 0) {
+			if (sweeping) {
+				uint64_t now = prof_now();
 
-			// Copy captured data into fftw3 in buffer
-			if ( cnt < fft_size ){
-				in[cnt] = i + q*I;
-				cnt++;
+				printf("\tSweep %u: %u steps in %.1f ms, %.2f sweeps/s, %u steps missing\n",
+					sweep.sweeps, sweep.nsteps, (now - sweep_last) / 1e6,
+					1e9 / (now - sweep_last), sweep.missing);
+				sweep_last = now;
 			}
-			// Print data to file
-			fprintf(fp2, "%d,%d\n", i, q);
-		}
-
-		fftw_execute(plan);
-
-		// Sample counter increment and status output
-		nrx += nbytes_rx / iio_device_get_sample_size(rx);
-		ntx += nbytes_tx / iio_device_get_sample_size(tx);
-		printf("\tRX %8.2f MSmp, TX %8.2f MSmp\n", nrx/1e6, ntx/1e6);
-
-		snprintf(buf, sizeof(buf), "fft-%d.txt", NORUNS-count+1);
-		fp3 = fopen(buf, "w");
-		//fp3 = fopen("fft.csv", "w");
-		for(cnt = 0; cnt<fft_size; cnt++){
-			//mag = 10*log10( (creal(out[cnt]) * creal(out[cnt]) + cimag(out[cnt]) * cimag(out[cnt])) / ((unsigned long long)fft_size * fft_size));
-			mag = 20*log10( cabs(out[cnt]) );
-			// Shift FFT
-			// out_data[cnt] = mag;
-			// out_freq[cnt] = (RX_BW/FFT_SIZE)*cnt;
-			if (cnt >= fft_size/2){
-				out_data[cnt - fft_size/2] = mag;
-				out_freq[cnt - fft_size/2] = -(RX_BW/FFT_SIZE)*(fft_size/2 -cnt);
-			}
-			else{
-				out_data[fft_size/2 + cnt] = mag;
-				out_freq[fft_size/2 + cnt] = (RX_BW/FFT_SIZE)*(cnt - fft_size/2);
-			}
-
-			fprintf(fp3, "%lf %lf\n", out_freq[cnt], out_data[cnt]);
+			printf("\tRX %8.2f MSmp, %zu segments averaged\n", nrx/1e6, frame_nseg);
+			printf("\tring %u/%u (max %u), dropped %llu bufs (%.2f MSmp), gaps %llu\n",
+				ringbuf_fill(&rx_ring), rx_ring.count,
+				(unsigned int) atomic_load(&rx_ring.high_water),
+				(unsigned long long) atomic_load(&rx_ring.dropped),
+				atomic_load(&rx_ring.dropped_samples)/1e6,
+				(unsigned long long) gaps);
+			if (txbuf && tx_mode == TX_STREAM)
+				printf("\tTX %8.2f MSmp, ring %u/%u, underflows %llu\n",
+					atomic_load(&tx_pushed) * TX_BLOCK / 1e6, ringbuf_fill(&tx_ring),
+					tx_ring.count, (unsigned long long) atomic_load(&tx_underflows));
 		}
-		fclose(fp3);
 
-		// WRITE: Get pointers to TX buf and write IQ to TX buf port 0
-		p_inc = iio_buffer_step(txbuf);
-		p_end = iio_buffer_end(txbuf);
-
-		float freq1 = 2.0 * M_PI * FREQ1; // sine wave (should be easy to spot);
-
-		double ampl = 32767;
-
-		double i = 1. / txcfg.fs_hz;
-
-		fp1 = fopen("output.csv", "w+");
-		for (p_dat = iio_buffer_first(txbuf, tx0_i); p_dat < p_end; p_dat += p_inc) {
-			// fill with sine wave
-			short ipart = ampl * sin(freq1 * i);
-			short qpart = ampl * cos(freq1 * i);
+		if (frame_done) {
+			PROF_START(t_out);
+			ret = specfile_write(&spec, sweeping ? sweep.out : psd_data, frame_seq, frame_nseg,
+				spec_flags);
+			PROF_END(PROF_OUTPUT, t_out, spec_hdr.nfft);
+			if (ret < 0) {
+				fprintf(stderr, "Error writing %s: %s\n", spec_path, strerror(-ret));
+				break;
+			}
+			spec_flags = 0;
+			frame_blocks = 0;
+			frame_nseg = 0;
+			count--;
+		}
 
-			((int16_t *)p_dat)[0] = ipart;
-			((int16_t *)p_dat)[1] = qpart;
+		// a frame must not take longer than its samples last, or the ring fills up
+		if (prof_enabled) {
+			uint64_t now = prof_now();
+
+			prof_add(PROF_FRAME, now - t_frame, frame_samples);
+			if (now - t_frame > frame_samples * 1e9 / rx_src.fs_hz)
+				prof_count(PROF_OVERRUNS, 1);
+			if (prof_interval > 0 && now - prof_last >= prof_interval * 1e9) {
+				printf("* Stage timing after %.1f s\n", (now - prof_start) / 1e9);
+				prof_print(stdout, (now - prof_start) / 1e9);
+				prof_last = now;
+			}
+		}
+	}
 
-			// Save what's actually in the TX buffer to file
-			fprintf(fp1, "%d,%d\n", ((int16_t*)p_dat)[0], ((int16_t*)p_dat)[1]);
+	run_ns = prof_now() - prof_start;
 
-			i += 1. / txcfg.fs_hz;
+	// Stop TX: wake the push thread if it is blocked on the DAC, then the generator
+	if (tx_mode == TX_STREAM) {
+		tx_stop = true;
+		if (txbuf) {
+			iio_buffer_cancel(txbuf);
+			pthread_join(tx_th, NULL);
 		}
-		fclose(fp1);
-		count--;
+		pthread_join(tx_gen_th, NULL);
+		if (txbuf)
+			printf("* TX: %llu blocks pushed, %llu underflows%s\n",
+				(unsigned long long) atomic_load(&tx_pushed),
+				(unsigned long long) atomic_load(&tx_underflows),
+				tx_error < 0 ? ", stopped on push error" : "");
 	}
 
-	// thread_info = pthread_cancel(tx_th);
-  // if (thread_info != 0)
-  // 	printf("pthread_cancel error\n");
-	//
-  // /* Join with thread to see what its exit status was */
-	// thread_info = pthread_join(tx_th, &res);
-  // if (thread_info != 0)
-  // 	printf("pthread_join error\n");
+	// Stop capture: wake the RX thread if it is blocked in a refill or pacing wait
+	stop = true;
+	source_cancel(&rx_src);
+	pthread_join(rx_th, NULL);
+	source_close(&rx_src);
+
+	printf("* Capture: %llu bufs published, %llu dropped (%.2f MSmp lost)%s\n",
+		(unsigned long long) atomic_load(&rx_ring.produced),
+		(unsigned long long) atomic_load(&rx_ring.dropped),
+		atomic_load(&rx_ring.dropped_samples)/1e6,
+		rx_error < 0 ? ", stopped on refill error" : "");
+	if (rx_src.fastlock && fastlock.hops)
+		printf("* Fastlock: %llu hops, %llu slot loads, %.1f us mean, %.1f us worst per hop, "
+			"%.2f ms per calibration\n", (unsigned long long) fastlock.hops,
+			(unsigned long long) fastlock.loads, fastlock.hop_ns / 1e3 / fastlock.hops,
+			fastlock.hop_max_ns / 1e3, fastlock.init_seconds * 1e3 / fastlock.nprof);
+	if (run_seconds > 0)
+		throughput_report(run_ns / 1e9, nrx, gaps, specfile_frames(&spec));
 	printf("* Shutting down\n");
-	fclose(fp2);
-	fftw_destroy_plan(plan);
-	fftw_free(in);
-	fftw_free(out);
+	if (rx_rec) {
+		ret = recorder_close(&rec);
+		printf("* Recorded %.2f MSmp to %s, %.2f MSmp dropped%s\n",
+			atomic_load(&rec.samples)/1e6, rec_path, atomic_load(&rec.dropped)/1e6,
+			ret < 0 ? ", write error" : "");
+		prof_count(PROF_REC_DROPPED, atomic_load(&rec.dropped));
+		rx_rec = NULL;
+	}
+	if (prof_enabled) {
+		double elapsed = (prof_now() - prof_start) / 1e9;
+
+		printf("* Stage timing over %.2f s\n", elapsed);
+		prof_print(stdout, elapsed);
+		if (prof_path) {
+			ret = prof_dump(prof_path, elapsed);
+			if (ret < 0)
+				fprintf(stderr, "Could not write %s: %s\n", prof_path, strerror(-ret));
+			else
+				printf("* Timing dump written to %s\n", prof_path);
+		}
+	}
+	printf("* Closing %s, %zu frames\n", spec_path, specfile_frames(&spec));
+	specfile_close(&spec);
+	welch_free(&psd);
+	sweep_free(&sweep);
+	fastlock_free(&fastlock);
+	free(psd_data);
+	txwave_free(&txw);
+	ringbuf_free(&tx_ring);
+	ringbuf_free(&rx_ring);
 
 	// Temp, quit now as hing on buffer destroy? Need to figure out why. mem leakage :-/
 	//return (0);
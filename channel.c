@@ -0,0 +1,310 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Channel emulator: TX samples in, impaired and quantised RX samples out
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "channel.h"
+#include "nco.h"
+
+#define CHUNK 256                     // samples per inner pass, kept on the stack
+#define DAC_FULL_SCALE 32768.0
+#define RAD_TO_TURN (4294967296.0 / (2 * M_PI))
+
+enum { PASS_PHASE_NOISE, PASS_APPLY };
+
+void channel_cfg_default(struct channel_cfg *cfg)
+{
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->gain_db = -10;
+	cfg->noise_dbfs = -80;
+	cfg->bits = 12;
+	cfg->seed = 1;
+}
+
+int channel_cfg_parse(struct channel_cfg *cfg, const char *str)
+{
+	char key[16];
+	double v;
+	int used;
+
+	while (str && *str) {
+		if (sscanf(str, "%15[^=,]=%lf%n", key, &v, &used) != 2)
+			return -EINVAL;
+		if (!strcmp(key, "delay") && v >= 0)
+			cfg->delay = v;
+		else if (!strcmp(key, "gain"))
+			cfg->gain_db = v;
+		else if (!strcmp(key, "cfo"))
+			cfg->cfo_hz = v;
+		else if (!strcmp(key, "pn") && v >= 0)
+			cfg->pn_hz = v;
+		else if (!strcmp(key, "noise"))
+			cfg->noise_dbfs = v;
+		else if (!strcmp(key, "iqgain"))
+			cfg->iq_gain_db = v;
+		else if (!strcmp(key, "iqphase"))
+			cfg->iq_phase_deg = v;
+		else if (!strcmp(key, "dci"))
+			cfg->dc_i = v;
+		else if (!strcmp(key, "dcq"))
+			cfg->dc_q = v;
+		else if (!strcmp(key, "bits") && v >= 2 && v <= 16)
+			cfg->bits = v;
+		else if (!strcmp(key, "threads") && v >= 0)
+			cfg->threads = v;
+		else if (!strcmp(key, "seed") && v >= 0)
+			cfg->seed = v;
+		else
+			return -EINVAL;
+		str += used;
+		if (*str == ',')
+			str++;
+		else if (*str)
+			return -EINVAL;
+	}
+	return 0;
+}
+
+void channel_cfg_str(const struct channel_cfg *cfg, char *buf, size_t len)
+{
+	snprintf(buf, len, "delay %u, gain %.1f dB, cfo %.1f Hz, pn %.1f Hz, noise %.1f dBFS, "
+		"iq %.2f dB/%.2f deg, dc %.1f/%.1f, %u bits",
+		cfg->delay, cfg->gain_db, cfg->cfo_hz, cfg->pn_hz, cfg->noise_dbfs,
+		cfg->iq_gain_db, cfg->iq_phase_deg, cfg->dc_i, cfg->dc_q, cfg->bits);
+}
+
+/* sample k of the delayed input: the held history first, then the new block */
+static inline const int16_t *input(const struct channel *ch, size_t k)
+{
+	size_t d = ch->cfg.delay;
+
+	return k < d ? ch->hist + 2*k : ch->src + 2*(k - d);
+}
+
+/* span of the current block handled by worker t */
+static void span(const struct channel *ch, unsigned int t, size_t *a, size_t *b)
+{
+	*a = ch->n * t / ch->nthreads;
+	*b = ch->n * (t + 1) / ch->nthreads;
+}
+
+/* random walk increments of the span, summed in place */
+static void phase_noise(struct channel_worker *w, size_t a, size_t b)
+{
+	struct channel *ch = w->ch;
+	double acc = 0;
+	size_t k;
+
+	noise_gauss(&w->noise, ch->pn + a, b - a, ch->pn_sigma);
+	for (k = a; k < b; k++) {
+		acc += ch->pn[k];
+		ch->pn[k] = acc;
+	}
+	w->pn_sum = acc;
+}
+
+static void apply(struct channel_worker *w, size_t a, size_t b)
+{
+	struct channel *ch = w->ch;
+	uint32_t phase[CHUNK];
+	float c[CHUNK], s[CHUNK], nz[2 * CHUNK];
+	size_t k, j, m;
+
+	for (k = a; k < b; k += m) {
+		m = b - k < CHUNK ? b - k : CHUNK;
+
+		// frequency offset from the accumulator, phase noise on top
+		for (j = 0; j < m; j++) {
+			phase[j] = ch->cfo_phase + (uint32_t)(k + j) * ch->cfo_step;
+			if (ch->pn_sigma > 0)
+				phase[j] += (uint32_t)(int64_t)llrint((w->pn_base + ch->pn[k + j]) * RAD_TO_TURN);
+		}
+		nco_sincos(phase, c, s, m);
+		if (ch->sigma > 0)
+			noise_gauss(&w->noise, nz, 2 * m, ch->sigma);
+		else
+			memset(nz, 0, sizeof(float) * 2 * m);
+
+		for (j = 0; j < m; j++) {
+			const int16_t *x = input(ch, k + j);
+			float i = x[0] * ch->scale, q = x[1] * ch->scale;
+			float ri = i * c[j] - q * s[j] + nz[2*j];
+			float rq = i * s[j] + q * c[j] + nz[2*j + 1];
+			// receiver IQ imbalance and DC, then the ADC
+			float oi = ch->iq_gi * ri + ch->cfg.dc_i;
+			float oq = ch->iq_gq * (rq * ch->iq_cos - ri * ch->iq_sin) + ch->cfg.dc_q;
+
+			oi = rintf(oi);
+			oq = rintf(oq);
+			ch->dst[2*(k + j)]     = oi > ch->qmax ? ch->qmax : oi < ch->qmin ? ch->qmin : oi;
+			ch->dst[2*(k + j) + 1] = oq > ch->qmax ? ch->qmax : oq < ch->qmin ? ch->qmin : oq;
+		}
+	}
+}
+
+static void *worker(void *arg)
+{
+	struct channel_worker *w = arg;
+	struct channel *ch = w->ch;
+	unsigned int seen = 0;
+	size_t a, b;
+
+	pthread_mutex_lock(&ch->lock);
+	for (;;) {
+		while (ch->gen == seen && !ch->closing)
+			pthread_cond_wait(&ch->start, &ch->lock);
+		if (ch->closing)
+			break;
+		seen = ch->gen;
+		pthread_mutex_unlock(&ch->lock);
+
+		span(ch, w->index, &a, &b);
+		if (ch->pass == PASS_PHASE_NOISE)
+			phase_noise(w, a, b);
+		else
+			apply(w, a, b);
+
+		pthread_mutex_lock(&ch->lock);
+		if (--ch->busy == 0)
+			pthread_cond_signal(&ch->done);
+	}
+	pthread_mutex_unlock(&ch->lock);
+	return NULL;
+}
+
+/* runs one pass on all workers and waits for them */
+static void run_pass(struct channel *ch, int pass)
+{
+	pthread_mutex_lock(&ch->lock);
+	ch->pass = pass;
+	ch->busy = ch->nthreads;
+	ch->gen++;
+	pthread_cond_broadcast(&ch->start);
+	while (ch->busy)
+		pthread_cond_wait(&ch->done, &ch->lock);
+	pthread_mutex_unlock(&ch->lock);
+}
+
+int channel_init(struct channel *ch, const struct channel_cfg *cfg, double fs, size_t max_block)
+{
+	double g = pow(10, cfg->iq_gain_db / 20);
+	double skew = cfg->iq_phase_deg * M_PI / 180;
+	long ncpu;
+	unsigned int t;
+
+	memset(ch, 0, sizeof(*ch));
+	if (fs <= 0 || max_block == 0 || cfg->bits < 2 || cfg->bits > 16)
+		return -EINVAL;
+	ch->cfg = *cfg;
+	ch->fs_hz = fs;
+	ch->max_block = max_block;
+
+	ch->scale = pow(10, cfg->gain_db / 20) * (1u << (cfg->bits - 1)) / DAC_FULL_SCALE;
+	ch->cfo_step = nco_step(fs, cfg->cfo_hz);
+	// Wiener phase noise: the increment variance is 2 pi linewidth / fs
+	ch->pn_sigma = sqrt(2 * M_PI * cfg->pn_hz / fs);
+	if (cfg->noise_dbfs > CHANNEL_NOISE_OFF)
+		ch->sigma = (1u << (cfg->bits - 1)) * pow(10, cfg->noise_dbfs / 20) / sqrt(2);
+	// the imbalance is split evenly so the mean power stays the same
+	ch->iq_gi = 2 / (1 + g);
+	ch->iq_gq = 2 * g / (1 + g);
+	ch->iq_cos = cos(skew);
+	ch->iq_sin = sin(skew);
+	ch->qmax = (1 << (cfg->bits - 1)) - 1;
+	ch->qmin = -(1 << (cfg->bits - 1));
+
+	ch->hist = calloc(2 * (size_t)cfg->delay + 2, sizeof(int16_t));
+	ch->pn = malloc(sizeof(float) * max_block);
+	if (!ch->hist || !ch->pn) {
+		free(ch->hist);
+		free(ch->pn);
+		return -ENOMEM;
+	}
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	ch->nthreads = cfg->threads ? cfg->threads : ncpu > 0 ? ncpu : 1;
+	if (ch->nthreads > CHANNEL_MAX_THREADS)
+		ch->nthreads = CHANNEL_MAX_THREADS;
+
+	pthread_mutex_init(&ch->lock, NULL);
+	pthread_cond_init(&ch->start, NULL);
+	pthread_cond_init(&ch->done, NULL);
+	for (t = 0; t < ch->nthreads; t++) {
+		struct channel_worker *w = &ch->w[t];
+
+		w->ch = ch;
+		w->index = t;
+		noise_seed(&w->noise, cfg->seed + t);
+		if (pthread_create(&w->thread, NULL, worker, w)) {
+			ch->nthreads = t;
+			channel_free(ch);
+			return -EAGAIN;
+		}
+	}
+	return 0;
+}
+
+void channel_run(struct channel *ch, const int16_t *tx, int16_t *rx, size_t n)
+{
+	size_t d = ch->cfg.delay;
+	double base;
+	unsigned int t;
+
+	if (n > ch->max_block)
+		n = ch->max_block;
+	ch->src = tx;
+	ch->dst = rx;
+	ch->n = n;
+
+	if (ch->pn_sigma > 0) {
+		run_pass(ch, PASS_PHASE_NOISE);
+		// chain the span totals so each worker knows its starting phase
+		base = ch->pn_phase;
+		for (t = 0; t < ch->nthreads; t++) {
+			ch->w[t].pn_base = base;
+			base += ch->w[t].pn_sum;
+		}
+		ch->pn_phase = remainder(base, 2 * M_PI);
+	}
+	run_pass(ch, PASS_APPLY);
+	ch->cfo_phase += (uint32_t)n * ch->cfo_step;
+
+	// keep the last d input samples for the next block
+	if (d == 0)
+		return;
+	if (n >= d) {
+		memcpy(ch->hist, tx + 2*(n - d), sizeof(int16_t) * 2 * d);
+	} else {
+		memmove(ch->hist, ch->hist + 2*n, sizeof(int16_t) * 2 * (d - n));
+		memcpy(ch->hist + 2*(d - n), tx, sizeof(int16_t) * 2 * n);
+	}
+}
+
+void channel_free(struct channel *ch)
+{
+	unsigned int t;
+
+	pthread_mutex_lock(&ch->lock);
+	ch->closing = true;
+	pthread_cond_broadcast(&ch->start);
+	pthread_mutex_unlock(&ch->lock);
+	for (t = 0; t < ch->nthreads; t++)
+		pthread_join(ch->w[t].thread, NULL);
+	ch->nthreads = 0;
+
+	pthread_mutex_destroy(&ch->lock);
+	pthread_cond_destroy(&ch->start);
+	pthread_cond_destroy(&ch->done);
+	free(ch->hist);
+	free(ch->pn);
+	ch->hist = NULL;
+	ch->pn = NULL;
+}
@@ -0,0 +1,112 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Channel emulator: TX samples in, impaired and quantised RX samples out
+*/
+
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "noise.h"
+
+#define CHANNEL_MAX_THREADS 8
+#define CHANNEL_NOISE_OFF -200.0   // noise_dbfs at or below this adds no noise
+
+/* impairments, in the order they are applied */
+struct channel_cfg {
+	unsigned int delay;       // samples
+	double gain_db;           // 0 dB maps DAC full scale onto ADC full scale
+	double cfo_hz;            // carrier frequency offset
+	double pn_hz;             // phase noise as a Wiener process of this 3 dB linewidth
+	double noise_dbfs;        // complex AWGN power relative to ADC full scale
+	double iq_gain_db;        // Q branch gain relative to I
+	double iq_phase_deg;      // Q branch phase skew
+	double dc_i;              // DC offset, ADC codes
+	double dc_q;
+	unsigned int bits;        // ADC width, output is rounded and saturated to it
+	unsigned int threads;     // workers, 0 for one per CPU up to CHANNEL_MAX_THREADS
+	uint64_t seed;
+};
+
+struct channel;
+
+struct channel_worker {
+	struct channel *ch;
+	pthread_t thread;
+	unsigned int index;
+	struct noise noise;       // own generator, no sharing between workers
+	double pn_base;           // phase noise at the start of this worker's span
+	double pn_sum;            // phase noise accumulated over the span
+};
+
+/*
+	 A block is split into one contiguous span per worker. Everything but
+	 the phase noise depends only on the sample index, so the spans are
+	 independent: the frequency offset phase of sample k is known directly
+	 from the 32 bit accumulator. Phase noise is a random walk and is done
+	 in two passes, each worker sums the increments of its span, the
+	 caller chains the span totals and then every worker applies the
+	 impairments with its starting phase known. For a given seed and
+	 thread count the output is reproducible.
+*/
+struct channel {
+	struct channel_cfg cfg;
+	double fs_hz;
+	size_t max_block;
+
+	// derived from cfg
+	float scale;              // DAC codes to ADC codes
+	uint32_t cfo_step;
+	uint32_t cfo_phase;       // at the start of the next block
+	float pn_sigma;           // phase increment std deviation per sample, radians
+	double pn_phase;          // at the start of the next block, radians
+	float sigma;              // noise std deviation per component, ADC codes
+	float iq_gi, iq_gq, iq_cos, iq_sin;
+	float qmin, qmax;
+
+	int16_t *hist;            // the last delay TX samples
+	float *pn;                // per sample phase noise of the current block
+
+	// current block, shared with the workers
+	const int16_t *src;
+	int16_t *dst;
+	size_t n;
+	int pass;
+
+	unsigned int nthreads;
+	struct channel_worker w[CHANNEL_MAX_THREADS];
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	unsigned int gen;         // bumped for every pass
+	unsigned int busy;        // workers still in the current pass
+	bool closing;
+};
+
+/* no impairments but 12 bit quantisation, -10 dB gain and -80 dBFS noise */
+void channel_cfg_default(struct channel_cfg *cfg);
+
+/*
+	 Parses "key=value,key=value", keys: delay, gain, cfo, pn, noise,
+	 iqgain, iqphase, dci, dcq, bits, threads, seed. -EINVAL on an
+	 unknown key or a bad value.
+*/
+int channel_cfg_parse(struct channel_cfg *cfg, const char *str);
+
+/* one line summary of a configuration */
+void channel_cfg_str(const struct channel_cfg *cfg, char *buf, size_t len);
+
+/* starts the workers, blocks passed to channel_run() hold at most max_block samples */
+int channel_init(struct channel *ch, const struct channel_cfg *cfg, double fs, size_t max_block);
+
+/* impairs n interleaved int16 I/Q samples from tx into rx, state carries across calls */
+void channel_run(struct channel *ch, const int16_t *tx, int16_t *rx, size_t n);
+
+void channel_free(struct channel *ch);
+
+#endif
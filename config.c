@@ -0,0 +1,376 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Runtime configuration: built in profiles, config files and command line overrides
+*/
+
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "db.h"
+#include "fftplan.h"
+#include "welch.h"
+
+enum key_type {
+	KEY_STR,
+	KEY_HZ,       // double, k M G are powers of 1000
+	KEY_SIZE,     // size_t, k M are powers of 1024
+	KEY_UINT,
+	KEY_INT,
+	KEY_REAL,
+	KEY_BOOL,
+	KEY_WINDOW,
+	KEY_DB,
+	KEY_RIGOR,
+};
+
+#define KEY(name, type, min, max) { #name, type, offsetof(struct spectrum_config, name), min, max }
+
+static const struct {
+	const char *name;
+	enum key_type type;
+	size_t offset;
+	double min, max;          // numeric keys only
+} keys[] = {
+	KEY(source,      KEY_STR,    0, 0),
+	KEY(rx_lo,       KEY_HZ,     70e6, 6e9),
+	KEY(rx_fs,       KEY_HZ,     1, 61.44e6),
+	KEY(rx_bw,       KEY_HZ,     1, 56e6),
+	KEY(tx_lo,       KEY_HZ,     47e6, 6e9),
+	KEY(tx_fs,       KEY_HZ,     1, 61.44e6),
+	KEY(tx_bw,       KEY_HZ,     1, 56e6),
+	KEY(freq1,       KEY_HZ,     -30.72e6, 30.72e6),
+	KEY(freq2,       KEY_HZ,     -30.72e6, 30.72e6),
+	KEY(runs,        KEY_UINT,   1, 1e9),
+	KEY(buffer_size, KEY_SIZE,   16, 64*1024*1024),
+	KEY(kernel_buffers, KEY_UINT, 1, 64),
+	KEY(ring_blocks, KEY_UINT,   2, 4096),
+	KEY(fft_size,    KEY_SIZE,   16, 64*1024*1024),
+	KEY(overlap,     KEY_REAL,   0, 0.95),
+	KEY(window,      KEY_WINDOW, 0, 0),
+	KEY(db_mode,     KEY_DB,     0, 0),
+	KEY(rigor,       KEY_RIGOR,  0, 0),
+	KEY(fft_threads, KEY_INT,    0, 1024),
+	KEY(dbfs,        KEY_BOOL,   0, 0),
+	KEY(sweep_start, KEY_HZ,     70e6, 6e9),
+	KEY(sweep_stop,  KEY_HZ,     70e6, 6e9),
+	KEY(sweep_keep,  KEY_REAL,   0.05, 1),
+	KEY(sweep_settle, KEY_REAL,  0, 1),
+	KEY(fastlock,    KEY_BOOL,   0, 0),
+	KEY(fastlock_settle, KEY_REAL, 0, 1),
+};
+
+/*
+	 Settings on top of the defaults. highres trades latency for bin
+	 width with 1M point FFTs of 1 MiS refills; lowlatency uses 16K point
+	 FFTs of 16 KiS refills, blocks 64 times shorter, so its ring holds
+	 64 of them for the same slack. sweep steps the LO over the whole
+	 AD9361 range with lowlatency's sizes.
+*/
+static const struct {
+	const char *name;
+	const char *desc;
+	const char *settings;
+} profiles[] = {
+	{ "highres",    "1M point FFT of 1 MiS refills, 29 Hz bins, a frame every 34 ms",
+		"fft_size=1M,buffer_size=1M,ring_blocks=8" },
+	{ "lowlatency", "16K point FFT of 16 KiS refills, 1.9 kHz bins, a frame every 0.5 ms",
+		"fft_size=16k,buffer_size=16k,ring_blocks=64" },
+	{ "sweep",      "70 MHz to 6 GHz in 18.4 MHz steps of 16K points, 1.9 kHz bins",
+		"sweep_start=70M,sweep_stop=6G,fft_size=16k,buffer_size=16k,ring_blocks=64" },
+};
+
+void config_default(struct spectrum_config *cfg)
+{
+	memset(cfg, 0, sizeof(*cfg));
+	snprintf(cfg->source, sizeof(cfg->source), "ip:192.168.1.227");
+	cfg->rx_lo = 1e9;
+	cfg->rx_fs = 30.72e6;
+	cfg->rx_bw = 19.365e6;     // ~20 MHz rf bandwidth
+	cfg->tx_lo = 1e9;
+	cfg->tx_fs = 30.72e6;
+	cfg->tx_bw = 19.365e6;
+	cfg->freq1 = 5e6;
+	cfg->freq2 = 0;
+	cfg->runs = 10;
+	cfg->buffer_size = 1024*1024;
+	cfg->kernel_buffers = 4;         // libiio's default
+	cfg->ring_blocks = 8;
+	cfg->fft_size = 1024*1024;
+	cfg->overlap = 0.5;
+	cfg->window = WINDOW_HANN;
+	cfg->db_mode = DB_FAST;
+	cfg->rigor = PLAN_MEASURE;
+	cfg->fft_threads = 0;
+	cfg->dbfs = false;
+	cfg->sweep_start = 0;
+	cfg->sweep_stop = 0;
+	// the analog filter is flat over about 0.6 fs at the default 19.4 MHz / 30.72 MS/s
+	cfg->sweep_keep = 0.6;
+	cfg->sweep_settle = 1e-3;
+	cfg->fastlock = true;
+	cfg->fastlock_settle = 50e-6;
+}
+
+/* number with an optional k/M/G suffix, base is 1000 or 1024 */
+static int parse_scaled(const char *s, double base, double *v)
+{
+	char *end;
+
+	errno = 0;
+	*v = strtod(s, &end);
+	if (end == s || errno)
+		return -EINVAL;
+	switch (*end) {
+	case 'k': case 'K': *v *= base; end++; break;
+	case 'M': *v *= base * base; end++; break;
+	case 'G': *v *= base * base * base; end++; break;
+	}
+	while (isspace((unsigned char)*end))
+		end++;
+	return *end ? -EINVAL : 0;
+}
+
+int config_set(struct spectrum_config *cfg, const char *key, const char *value)
+{
+	unsigned int i;
+	char *field;
+	double v = 0;
+	int e;
+
+	for (i = 0; i < sizeof(keys)/sizeof(keys[0]); i++)
+		if (!strcmp(key, keys[i].name))
+			break;
+	if (i == sizeof(keys)/sizeof(keys[0]))
+		return -ENOENT;
+	field = (char *)cfg + keys[i].offset;
+
+	switch (keys[i].type) {
+	case KEY_STR:
+		if (!*value || strlen(value) >= sizeof(cfg->source))
+			return -EINVAL;
+		strcpy(field, value);
+		return 0;
+	case KEY_BOOL:
+		if (!strcmp(value, "1") || !strcmp(value, "yes") || !strcmp(value, "true"))
+			*(bool *)field = true;
+		else if (!strcmp(value, "0") || !strcmp(value, "no") || !strcmp(value, "false"))
+			*(bool *)field = false;
+		else
+			return -EINVAL;
+		return 0;
+	case KEY_WINDOW:
+		e = welch_window_parse(value);
+		break;
+	case KEY_DB:
+		e = db_mode_parse(value);
+		break;
+	case KEY_RIGOR:
+		e = fftplan_rigor_parse(value);
+		break;
+	default:
+		if (parse_scaled(value, keys[i].type == KEY_SIZE ? 1024 : 1000, &v) < 0)
+			return -EINVAL;
+		// 0 is a sweep that is off, config_write() saves it like that
+		if ((v < keys[i].min || v > keys[i].max) && !(v == 0 &&
+				(keys[i].offset == offsetof(struct spectrum_config, sweep_start) ||
+				keys[i].offset == offsetof(struct spectrum_config, sweep_stop))))
+			return -EINVAL;
+		if (keys[i].type != KEY_HZ && keys[i].type != KEY_REAL && v != floor(v))
+			return -EINVAL;
+		// ring slots are indexed with a mask
+		if (keys[i].offset == offsetof(struct spectrum_config, ring_blocks) &&
+				((unsigned int)v & ((unsigned int)v - 1)))
+			return -EINVAL;
+		e = 0;
+		break;
+	}
+	if (e < 0)
+		return -EINVAL;
+
+	switch (keys[i].type) {
+	case KEY_HZ:
+	case KEY_REAL:
+		*(double *)field = v;
+		break;
+	case KEY_SIZE:
+		*(size_t *)field = v;
+		break;
+	case KEY_UINT:
+		*(unsigned int *)field = v;
+		break;
+	case KEY_INT:
+		*(int *)field = v;
+		break;
+	default:
+		*(int *)field = e;
+		break;
+	}
+	return 0;
+}
+
+int config_set_pair(struct spectrum_config *cfg, const char *pair)
+{
+	char key[32];
+	const char *eq = strchr(pair, '=');
+
+	if (!eq || eq == pair || eq - pair >= (ptrdiff_t)sizeof(key))
+		return -EINVAL;
+	memcpy(key, pair, eq - pair);
+	key[eq - pair] = '\0';
+	return config_set(cfg, key, eq + 1);
+}
+
+int config_profile(struct spectrum_config *cfg, const char *name)
+{
+	char buf[256], *p, *tok;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < sizeof(profiles)/sizeof(profiles[0]); i++)
+		if (!strcmp(name, profiles[i].name))
+			break;
+	if (i == sizeof(profiles)/sizeof(profiles[0]))
+		return -ENOENT;
+
+	snprintf(buf, sizeof(buf), "%s", profiles[i].settings);
+	for (tok = strtok_r(buf, ",", &p); tok; tok = strtok_r(NULL, ",", &p)) {
+		ret = config_set_pair(cfg, tok);
+		if (ret < 0)
+			return ret;
+	}
+	snprintf(cfg->profile, sizeof(cfg->profile), "%s", name);
+	return 0;
+}
+
+/* strips leading and trailing blanks in place */
+static char *trim(char *s)
+{
+	char *e;
+
+	while (isspace((unsigned char)*s))
+		s++;
+	e = s + strlen(s);
+	while (e > s && isspace((unsigned char)e[-1]))
+		*--e = '\0';
+	return s;
+}
+
+int config_load(struct spectrum_config *cfg, const char *path, const char *profile)
+{
+	char line[512], *s, *eq;
+	bool active = true, found = false;
+	unsigned int lineno = 0;
+	int err = 0, ret;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return -errno;
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		if ((s = strchr(line, '#')))
+			*s = '\0';
+		s = trim(line);
+		if (!*s)
+			continue;
+
+		if (*s == '[') {
+			eq = strchr(s, ']');
+			if (!eq) {
+				fprintf(stderr, "%s:%u: unterminated section\n", path, lineno);
+				err = err ? err : -EINVAL;
+				continue;
+			}
+			*eq = '\0';
+			active = profile && !strcmp(trim(s + 1), profile);
+			found |= active;
+			continue;
+		}
+		if (!active)
+			continue;
+
+		eq = strchr(s, '=');
+		if (!eq) {
+			fprintf(stderr, "%s:%u: expected key = value\n", path, lineno);
+			err = err ? err : -EINVAL;
+			continue;
+		}
+		*eq = '\0';
+		ret = config_set(cfg, trim(s), trim(eq + 1));
+		if (ret < 0) {
+			fprintf(stderr, "%s:%u: %s \"%s\"\n", path, lineno,
+				ret == -ENOENT ? "unknown key" : "bad value for", trim(s));
+			err = err ? err : ret;
+		}
+	}
+	fclose(fp);
+	if (found)
+		snprintf(cfg->profile, sizeof(cfg->profile), "%s", profile);
+	return err;
+}
+
+static bool key_listed(const char *name, const char *const *list)
+{
+	for (; *list; list++)
+		if (!strcmp(name, *list))
+			return true;
+	return false;
+}
+
+void config_write(FILE *fp, const struct spectrum_config *cfg)
+{
+	config_write_keys(fp, cfg, NULL);
+}
+
+void config_write_keys(FILE *fp, const struct spectrum_config *cfg, const char *const *list)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(keys)/sizeof(keys[0]); i++) {
+		const char *field = (const char *)cfg + keys[i].offset;
+
+		if (list && !key_listed(keys[i].name, list))
+			continue;
+
+		fprintf(fp, "%-12s = ", keys[i].name);
+		switch (keys[i].type) {
+		case KEY_STR:    fprintf(fp, "%s\n", field); break;
+		case KEY_HZ:     fprintf(fp, "%.0f\n", *(const double *)field); break;
+		case KEY_REAL:   fprintf(fp, "%g\n", *(const double *)field); break;
+		case KEY_SIZE:   fprintf(fp, "%zu\n", *(const size_t *)field); break;
+		case KEY_UINT:   fprintf(fp, "%u\n", *(const unsigned int *)field); break;
+		case KEY_INT:    fprintf(fp, "%d\n", *(const int *)field); break;
+		case KEY_BOOL:   fprintf(fp, "%s\n", *(const bool *)field ? "yes" : "no"); break;
+		case KEY_WINDOW: fprintf(fp, "%s\n", welch_window_name(*(const int *)field)); break;
+		case KEY_DB:     fprintf(fp, "%s\n", db_mode_name(*(const int *)field)); break;
+		case KEY_RIGOR:  fprintf(fp, "%s\n", fftplan_rigor_name(*(const int *)field)); break;
+		}
+	}
+}
+
+const char *config_profile_name(unsigned int i, const char **desc)
+{
+	if (i >= sizeof(profiles)/sizeof(profiles[0]))
+		return NULL;
+	if (desc)
+		*desc = profiles[i].desc;
+	return profiles[i].name;
+}
+
+const char *config_keys(void)
+{
+	static char buf[512];
+	unsigned int i;
+	size_t len = 0;
+
+	if (!buf[0])
+		for (i = 0; i < sizeof(keys)/sizeof(keys[0]); i++)
+			len += snprintf(buf + len, sizeof(buf) - len, "%s%s", i ? " " : "", keys[i].name);
+	return buf;
+}
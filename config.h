@@ -0,0 +1,92 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Runtime configuration: built in profiles, config files and command line overrides
+*/
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+	 Everything that used to be a #define in a copy of the spectrum tool.
+	 Settings are applied in order, later ones win: the built in defaults,
+	 a built in profile, the top of a config file, the file's [profile]
+	 section and finally the command line.
+*/
+struct spectrum_config {
+	char profile[32];         // name of the last profile applied, "" for none
+	char source[256];         // sample source, an IIO URI or a file, see source_open()
+
+	// radio
+	double rx_lo;
+	double rx_fs;
+	double rx_bw;
+	double tx_lo;
+	double tx_fs;
+	double tx_bw;
+	double freq1;             // 1st TX test tone
+	double freq2;             // 2nd TX test tone, 0 for a single tone
+
+	// capture and DSP
+	unsigned int runs;        // frames before exiting
+	size_t buffer_size;       // samples per refill and capture ring block
+	unsigned int kernel_buffers; // refills the kernel queues ahead of the reader
+	unsigned int ring_blocks; // capture ring length, power of two
+	size_t fft_size;          // Welch segment length
+	double overlap;           // fraction of a segment shared with the next one
+	int window;               // enum window_type
+	int db_mode;              // enum db_mode
+	int rigor;                // enum plan_rigor
+	int fft_threads;          // 0 for one per CPU
+	bool dbfs;                // scale samples to ADC full scale
+
+	// sweep, off while sweep_stop is 0
+	double sweep_start;
+	double sweep_stop;
+	double sweep_keep;        // fraction of each step's band stitched in, the flat part
+	double sweep_settle;      // seconds discarded after each retune for the PLL to lock
+	bool fastlock;            // hop between stored AD9361 fastlock profiles where there are any
+	double fastlock_settle;   // sweep_settle for a hop to a stored profile, no calibration to wait for
+};
+
+/* the high resolution profile: 1M point FFT of 1 MiS refills at 30.72 MS/s, 1 GHz */
+void config_default(struct spectrum_config *cfg);
+
+/*
+	 Sets one key from its text value, e.g. ("fft_size", "16k"). Sizes take
+	 k, M suffixes (powers of 1024), frequencies k, M, G (powers of 1000).
+	 -ENOENT for an unknown key, -EINVAL for a bad value.
+*/
+int config_set(struct spectrum_config *cfg, const char *key, const char *value);
+
+/* "key=value" form of config_set() */
+int config_set_pair(struct spectrum_config *cfg, const char *pair);
+
+/* applies a built in profile, -ENOENT if there is none of that name */
+int config_profile(struct spectrum_config *cfg, const char *name);
+
+/*
+	 Reads "key = value" lines, # comments. Keys before the first [section]
+	 always apply, those in [profile] sections only when profile names it,
+	 a NULL profile skips all sections. Errors are reported on stderr with
+	 the line number, the return is the first one as negative errno.
+*/
+int config_load(struct spectrum_config *cfg, const char *path, const char *profile);
+
+/* writes cfg in the config file format, loading it back gives the same settings */
+void config_write(FILE *fp, const struct spectrum_config *cfg);
+
+/* config_write() of only the NULL terminated keys (all of them for NULL), e.g. for a [profile] section */
+void config_write_keys(FILE *fp, const struct spectrum_config *cfg, const char *const *keys);
+
+/* built in profile i and its one line description, NULL past the last one */
+const char *config_profile_name(unsigned int i, const char **desc);
+
+/* the valid keys, space separated, for usage() */
+const char *config_keys(void);
+
+#endif
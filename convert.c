@@ -0,0 +1,279 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Sample conversion: raw I/Q buffer to FFT input
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "convert.h"
+#include "simd.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define HOST_IS_BE true
+#else
+#define HOST_IS_BE false
+#endif
+
+static inline int32_t fmt16_value(uint16_t v, const struct iq16_fmt *f)
+{
+	if (f->swap)
+		v = (uint16_t)((v << 8) | (v >> 8));
+	v = (uint16_t)(v << f->lshift);
+	if (f->is_signed)
+		return (int16_t)v >> f->rshift;
+	return v >> f->rshift;
+}
+
+/* plain C, packed I/Q pairs */
+static void iq_scalar(fft_complex *dst, const void *src, size_t n,
+		const struct iq16_fmt *f, double scale)
+{
+	const uint16_t *s = src;
+	sample_t *d = (sample_t *)dst;
+	const sample_t sc = scale;
+	size_t k;
+
+	for (k = 0; k < n; k++) {
+		d[2*k + 0] = fmt16_value(s[2*k + 0], f) * sc; // Real (I)
+		d[2*k + 1] = fmt16_value(s[2*k + 1], f) * sc; // Imag (Q)
+	}
+}
+
+#ifdef HAVE_X86
+/*
+	 I/Q pairs are already interleaved the way fft_complex is, so the
+	 "deinterleave" is a straight widening int16 -> sample_t per lane.
+	 The format shifts are applied on the 16 bit lanes before widening.
+*/
+__attribute__((target("sse2")))
+static inline __m128i fmt16_sse2(__m128i v, const struct iq16_fmt *f,
+		__m128i ls, __m128i rs, __m128i *hi)
+{
+	__m128i lo;
+
+	if (f->swap)
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+	v = _mm_sll_epi16(v, ls);
+	if (f->is_signed) {
+		// sign extend int16 -> int32 without SSE4.1
+		v = _mm_sra_epi16(v, rs);
+		lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		*hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+	} else {
+		v = _mm_srl_epi16(v, rs);
+		lo = _mm_unpacklo_epi16(v, _mm_setzero_si128());
+		*hi = _mm_unpackhi_epi16(v, _mm_setzero_si128());
+	}
+	return lo;
+}
+
+__attribute__((target("sse2")))
+static void iq_sse2(fft_complex *dst, const void *src, size_t n,
+		const struct iq16_fmt *f, double scale)
+{
+	const uint16_t *s = src;
+	sample_t *d = (sample_t *)dst;
+	const __m128i ls = _mm_cvtsi32_si128(f->lshift);
+	const __m128i rs = _mm_cvtsi32_si128(f->rshift);
+#ifdef SPECTRUM_SINGLE
+	const __m128 vs = _mm_set1_ps(scale);
+#else
+	const __m128d vs = _mm_set1_pd(scale);
+#endif
+	size_t k = 0;
+
+	// 4 I/Q pairs per iteration
+	for (; k + 4 <= n; k += 4, s += 8, d += 8) {
+		__m128i hi, lo = fmt16_sse2(_mm_loadu_si128((const __m128i *)s), f, ls, rs, &hi);
+
+#ifdef SPECTRUM_SINGLE
+		_mm_storeu_ps(d + 0, _mm_mul_ps(_mm_cvtepi32_ps(lo), vs));
+		_mm_storeu_ps(d + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), vs));
+#else
+		_mm_storeu_pd(d + 0, _mm_mul_pd(_mm_cvtepi32_pd(lo), vs));
+		_mm_storeu_pd(d + 2, _mm_mul_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(lo, lo)), vs));
+		_mm_storeu_pd(d + 4, _mm_mul_pd(_mm_cvtepi32_pd(hi), vs));
+		_mm_storeu_pd(d + 6, _mm_mul_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(hi, hi)), vs));
+#endif
+	}
+	iq_scalar((fft_complex *)d, s, n - k, f, scale);
+}
+
+__attribute__((target("avx2")))
+static void iq_avx2(fft_complex *dst, const void *src, size_t n,
+		const struct iq16_fmt *f, double scale)
+{
+	const uint16_t *s = src;
+	sample_t *d = (sample_t *)dst;
+	const __m128i ls = _mm_cvtsi32_si128(f->lshift);
+	const __m128i rs = _mm_cvtsi32_si128(f->rshift);
+#ifdef SPECTRUM_SINGLE
+	const __m256 vs = _mm256_set1_ps(scale);
+#else
+	const __m256d vs = _mm256_set1_pd(scale);
+#endif
+	size_t k = 0;
+
+	// 8 I/Q pairs per iteration
+	for (; k + 8 <= n; k += 8, s += 16, d += 16) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)s);
+		__m256i lo, hi;
+
+		if (f->swap)
+			v = _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+		v = _mm256_sll_epi16(v, ls);
+		if (f->is_signed) {
+			v = _mm256_sra_epi16(v, rs);
+			lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(v));
+			hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(v, 1));
+		} else {
+			v = _mm256_srl_epi16(v, rs);
+			lo = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(v));
+			hi = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1));
+		}
+
+#ifdef SPECTRUM_SINGLE
+		_mm256_storeu_ps(d + 0, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), vs));
+		_mm256_storeu_ps(d + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), vs));
+#else
+		_mm256_storeu_pd(d + 0,  _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(lo)), vs));
+		_mm256_storeu_pd(d + 4,  _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(lo, 1)), vs));
+		_mm256_storeu_pd(d + 8,  _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(hi)), vs));
+		_mm256_storeu_pd(d + 12, _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(hi, 1)), vs));
+#endif
+	}
+	iq_scalar((fft_complex *)d, s, n - k, f, scale);
+}
+#endif
+
+static const struct iq_kernel kernels[] = {
+#ifdef HAVE_X86
+	{ "avx2",   iq_avx2 },
+	{ "sse2",   iq_sse2 },
+#endif
+	{ "scalar", iq_scalar },
+};
+
+static const struct iq_kernel *active = &kernels[sizeof(kernels)/sizeof(kernels[0]) - 1];
+
+const char *convert_init(void)
+{
+	size_t i;
+
+	// table is ordered widest first
+	for (i = 0; i < sizeof(kernels)/sizeof(kernels[0]); i++) {
+		if (simd_supported(kernels[i].name)) {
+			active = &kernels[i];
+			break;
+		}
+	}
+	return active->name;
+}
+
+bool convert_select(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(kernels)/sizeof(kernels[0]); i++) {
+		if (!strcmp(kernels[i].name, name) && simd_supported(kernels[i].name)) {
+			active = &kernels[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+const struct iq_kernel *convert_kernel(void)
+{
+	return active;
+}
+
+static bool same_format(const struct iio_data_format *a, const struct iio_data_format *b)
+{
+	return a->length == b->length && a->bits == b->bits && a->shift == b->shift &&
+		a->is_signed == b->is_signed && a->is_be == b->is_be;
+}
+
+static void layout_finish(struct iq_layout *l)
+{
+	const struct iio_data_format *f = &l->fmt_i;
+
+	l->packed = f->length == 16 && f->bits + f->shift <= 16 && l->q_offset == 2 &&
+		same_format(&l->fmt_i, &l->fmt_q);
+	if (l->packed) {
+		l->fmt16.swap = f->is_be != HOST_IS_BE;
+		l->fmt16.is_signed = f->is_signed;
+		l->fmt16.lshift = 16 - f->bits - f->shift;
+		l->fmt16.rshift = 16 - f->bits;
+	}
+}
+
+void convert_layout_init(struct iq_layout *l, const struct iio_channel *chn_i,
+		const struct iio_channel *chn_q, const struct iio_buffer *buf)
+{
+	l->fmt_i = *iio_channel_get_data_format(chn_i);
+	l->fmt_q = *iio_channel_get_data_format(chn_q);
+	l->q_offset = (char *)iio_buffer_first(buf, chn_q) - (char *)iio_buffer_first(buf, chn_i);
+	layout_finish(l);
+}
+
+void convert_layout_native(struct iq_layout *l)
+{
+	memset(l, 0, sizeof(*l));
+	l->fmt_i.length = 16;
+	l->fmt_i.bits = 16;
+	l->fmt_i.is_signed = true;
+	l->fmt_i.is_be = HOST_IS_BE;
+	l->fmt_q = l->fmt_i;
+	l->q_offset = 2;
+	layout_finish(l);
+}
+
+const char *convert_format_str(const struct iio_data_format *fmt, char *buf, size_t len)
+{
+	snprintf(buf, len, "%s:%c%u/%u>>%u", fmt->is_be ? "be" : "le",
+		fmt->is_signed ? 'S' : 'U', fmt->bits, fmt->length, fmt->shift);
+	return buf;
+}
+
+/* any container width or endianness, same rules as iio_channel_convert() */
+static int64_t load_value(const uint8_t *p, const struct iio_data_format *f)
+{
+	unsigned int k, bytes = f->length / 8;
+	uint64_t v = 0;
+
+	for (k = 0; k < bytes; k++)
+		v = (v << 8) | p[f->is_be ? k : bytes - 1 - k];
+	v >>= f->shift;
+	if (f->bits < 64) {
+		v &= (1ULL << f->bits) - 1;
+		if (f->is_signed && (v >> (f->bits - 1)) & 1)
+			v |= ~0ULL << f->bits;
+	}
+	return (int64_t) v;
+}
+
+size_t convert_iq(const struct iq_layout *l, fft_complex *dst, size_t n,
+		const void *src, size_t nsamples, ptrdiff_t step, double scale)
+{
+	size_t k, cnt = nsamples < n ? nsamples : n;
+
+	if (l->packed && step == 2 * sizeof(int16_t)) {
+		// only two 16 bit channels enabled: samples are contiguous, use SIMD
+		active->fn(dst, src, cnt, &l->fmt16, scale);
+	} else {
+		const uint8_t *p = src;
+		sample_t *d = (sample_t *)dst;
+
+		for (k = 0; k < cnt; k++, p += step) {
+			d[2*k + 0] = (sample_t)(load_value(p, &l->fmt_i) * scale);
+			d[2*k + 1] = (sample_t)(load_value(p + l->q_offset, &l->fmt_q) * scale);
+		}
+	}
+
+	if (cnt < n)
+		memset(dst + cnt, 0, (n - cnt) * sizeof(fft_complex));
+	return cnt;
+}
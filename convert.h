@@ -0,0 +1,82 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Sample conversion: raw I/Q buffer to FFT input
+*/
+
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dsp.h"
+
+#ifdef __APPLE__
+#include <iio/iio.h>
+#else
+#include <iio.h>
+#endif
+
+/*
+	 How to get a value out of a 16 bit container: optional byte swap, then
+	 (x << lshift) >> rshift with an arithmetic shift for signed data. This
+	 is the mask/shift/sign extension iio_channel_convert() does, in a form
+	 that maps onto two SIMD shifts.
+*/
+struct iq16_fmt {
+	bool swap;
+	bool is_signed;
+	unsigned int lshift;
+	unsigned int rshift;
+};
+
+/* converts n packed I/Q pairs (I, Q, I, Q, ... 16 bit each) into dst */
+typedef void (*iq_convert_fn)(fft_complex *dst, const void *src, size_t n,
+		const struct iq16_fmt *f, double scale);
+
+struct iq_kernel {
+	const char *name;
+	iq_convert_fn fn;
+};
+
+/* layout and data format of the I and Q channels inside an RX buffer */
+struct iq_layout {
+	struct iio_data_format fmt_i;
+	struct iio_data_format fmt_q;
+	ptrdiff_t q_offset;     // bytes from the I to the Q value of a sample
+	bool packed;            // I/Q are adjacent 16 bit values with one format
+	struct iq16_fmt fmt16;  // valid when packed
+};
+
+/* picks the widest kernel the CPU supports, returns its name */
+const char *convert_init(void);
+/* forces a kernel by name ("scalar", "sse2", "avx2"), false if unsupported */
+bool convert_select(const char *name);
+const struct iq_kernel *convert_kernel(void);
+
+/* reads the channel formats and offsets of an RX buffer */
+void convert_layout_init(struct iq_layout *l, const struct iio_channel *chn_i,
+		const struct iio_channel *chn_q, const struct iio_buffer *buf);
+/* layout for plain native endian int16 I/Q pairs, e.g. from a file */
+void convert_layout_native(struct iq_layout *l);
+/* format in the "le:S12/16>>0" notation used by the IIO scan elements */
+const char *convert_format_str(const struct iio_data_format *fmt, char *buf, size_t len);
+
+/*
+	 Converts min(n, nsamples) samples, src points to the I value of the first
+	 sample and samples are step bytes apart. Every value is multiplied by
+	 scale, use convert_scale_dbfs() to get full scale = 1. Zero fills the
+	 rest of dst and returns the number of samples converted.
+*/
+size_t convert_iq(const struct iq_layout *l, fft_complex *dst, size_t n,
+		const void *src, size_t nsamples, ptrdiff_t step, double scale);
+
+/* scale factor mapping a signed ADC code of the given width to +-1.0 */
+static inline double convert_scale_dbfs(unsigned int bits)
+{
+	return 1.0 / (double)(1u << (bits - 1));
+}
+
+#endif
@@ -0,0 +1,312 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Power and dB kernels for the post FFT stage
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "db.h"
+#include "simd.h"
+
+#define DB_PER_LOG2 3.0102999566398120f  // 10*log10(2)
+
+/* log2(1 + t) ~ t*(P1 + t*(P2 + t*(P3 + t*P4))) on [0, 1), max error 1.03e-4 */
+#define P1  1.43901446f
+#define P2 -0.679942653f
+#define P3  0.325593193f
+#define P4 -0.0847673116f
+
+static inline float fast_db(float x)
+{
+	union { float f; uint32_t u; } v = { x };
+	float e = (float)((int32_t)(v.u >> 23) - 127);
+	float t;
+
+	// x = 2^e * m with m in [1, 2), power is never negative
+	v.u = (v.u & 0x7fffff) | 0x3f800000;
+	t = v.f - 1.0f;
+	return DB_PER_LOG2 * (e + t*(P1 + t*(P2 + t*(P3 + t*P4))));
+}
+
+static void power_scalar(sample_t *dst, const sample_t *pwr, size_t n, sample_t offset)
+{
+	size_t k;
+
+	for (k = 0; k < n; k++)
+		dst[k] = fast_db(pwr[k]) + offset;
+}
+
+static void accumulate_scalar(sample_t *acc, const fft_complex *x, size_t n)
+{
+	const sample_t *s = (const sample_t *)x;
+	size_t k;
+
+	for (k = 0; k < n; k++)
+		acc[k] += s[2*k]*s[2*k] + s[2*k + 1]*s[2*k + 1];
+}
+
+#ifdef HAVE_X86
+/* fast_db() on 4 floats */
+__attribute__((target("sse2")))
+static inline __m128 fast_db_sse2(__m128 x)
+{
+	const __m128i u = _mm_castps_si128(x);
+	const __m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(u, 23), _mm_set1_epi32(127)));
+	const __m128 m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(u, _mm_set1_epi32(0x7fffff)),
+		_mm_set1_epi32(0x3f800000)));
+	const __m128 t = _mm_sub_ps(m, _mm_set1_ps(1.0f));
+	__m128 p;
+
+	p = _mm_add_ps(_mm_set1_ps(P3), _mm_mul_ps(t, _mm_set1_ps(P4)));
+	p = _mm_add_ps(_mm_set1_ps(P2), _mm_mul_ps(t, p));
+	p = _mm_add_ps(_mm_set1_ps(P1), _mm_mul_ps(t, p));
+	p = _mm_mul_ps(t, p);
+	return _mm_mul_ps(_mm_add_ps(e, p), _mm_set1_ps(DB_PER_LOG2));
+}
+
+#ifdef SPECTRUM_SINGLE
+/* re^2 + im^2 of 4 bins */
+__attribute__((target("sse2")))
+static inline __m128 power4_sse2(const float *s)
+{
+	__m128 a = _mm_loadu_ps(s), b = _mm_loadu_ps(s + 4);
+
+	a = _mm_mul_ps(a, a);
+	b = _mm_mul_ps(b, b);
+	return _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)),
+		_mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+}
+#endif
+
+__attribute__((target("sse2")))
+static inline __m128 load4_sse2(const sample_t *s)
+{
+#ifdef SPECTRUM_SINGLE
+	return _mm_loadu_ps(s);
+#else
+	return _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(s)), _mm_cvtpd_ps(_mm_loadu_pd(s + 2)));
+#endif
+}
+
+__attribute__((target("sse2")))
+static inline void store4_sse2(sample_t *d, __m128 v)
+{
+#ifdef SPECTRUM_SINGLE
+	_mm_storeu_ps(d, v);
+#else
+	_mm_storeu_pd(d, _mm_cvtps_pd(v));
+	_mm_storeu_pd(d + 2, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+#endif
+}
+
+__attribute__((target("sse2")))
+static void power_sse2(sample_t *dst, const sample_t *pwr, size_t n, sample_t offset)
+{
+	const __m128 off = _mm_set1_ps(offset);
+	size_t k = 0;
+
+	for (; k + 4 <= n; k += 4)
+		store4_sse2(dst + k, _mm_add_ps(fast_db_sse2(load4_sse2(pwr + k)), off));
+	power_scalar(dst + k, pwr + k, n - k, offset);
+}
+
+__attribute__((target("sse2")))
+static void accumulate_sse2(sample_t *acc, const fft_complex *x, size_t n)
+{
+	const sample_t *s = (const sample_t *)x;
+	size_t k = 0;
+
+#ifdef SPECTRUM_SINGLE
+	for (; k + 4 <= n; k += 4)
+		_mm_storeu_ps(acc + k, _mm_add_ps(_mm_loadu_ps(acc + k), power4_sse2(s + 2*k)));
+#else
+	// stay in double, acc may sum many segments
+	for (; k + 2 <= n; k += 2) {
+		__m128d q0 = _mm_loadu_pd(s + 2*k), q1 = _mm_loadu_pd(s + 2*k + 2);
+
+		q0 = _mm_mul_pd(q0, q0);
+		q1 = _mm_mul_pd(q1, q1);
+		_mm_storeu_pd(acc + k, _mm_add_pd(_mm_loadu_pd(acc + k),
+			_mm_add_pd(_mm_unpacklo_pd(q0, q1), _mm_unpackhi_pd(q0, q1))));
+	}
+#endif
+	accumulate_scalar(acc + k, x + k, n - k);
+}
+
+/* fast_db() on 8 floats */
+__attribute__((target("avx2")))
+static inline __m256 fast_db_avx2(__m256 x)
+{
+	const __m256i u = _mm256_castps_si256(x);
+	const __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(u, 23),
+		_mm256_set1_epi32(127)));
+	const __m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(u,
+		_mm256_set1_epi32(0x7fffff)), _mm256_set1_epi32(0x3f800000)));
+	const __m256 t = _mm256_sub_ps(m, _mm256_set1_ps(1.0f));
+	__m256 p;
+
+	p = _mm256_add_ps(_mm256_set1_ps(P3), _mm256_mul_ps(t, _mm256_set1_ps(P4)));
+	p = _mm256_add_ps(_mm256_set1_ps(P2), _mm256_mul_ps(t, p));
+	p = _mm256_add_ps(_mm256_set1_ps(P1), _mm256_mul_ps(t, p));
+	p = _mm256_mul_ps(t, p);
+	return _mm256_mul_ps(_mm256_add_ps(e, p), _mm256_set1_ps(DB_PER_LOG2));
+}
+
+#ifdef SPECTRUM_SINGLE
+/* re^2 + im^2 of 8 bins */
+__attribute__((target("avx2")))
+static inline __m256 power8_avx2(const float *s)
+{
+	__m256 a = _mm256_loadu_ps(s), b = _mm256_loadu_ps(s + 8);
+	__m256 h;
+
+	a = _mm256_mul_ps(a, a);
+	b = _mm256_mul_ps(b, b);
+	// hadd leaves bins as 0 1 4 5 | 2 3 6 7, put the 64 bit pairs back in order
+	h = _mm256_hadd_ps(a, b);
+	return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(h), _MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+__attribute__((target("avx2")))
+static void power_avx2(float *dst, const float *pwr, size_t n, float offset)
+{
+	const __m256 off = _mm256_set1_ps(offset);
+	size_t k = 0;
+
+	for (; k + 8 <= n; k += 8)
+		_mm256_storeu_ps(dst + k, _mm256_add_ps(fast_db_avx2(_mm256_loadu_ps(pwr + k)), off));
+	power_scalar(dst + k, pwr + k, n - k, offset);
+}
+
+__attribute__((target("avx2")))
+static void accumulate_avx2(float *acc, const fft_complex *x, size_t n)
+{
+	const float *s = (const float *)x;
+	size_t k = 0;
+
+	for (; k + 8 <= n; k += 8)
+		_mm256_storeu_ps(acc + k, _mm256_add_ps(_mm256_loadu_ps(acc + k), power8_avx2(s + 2*k)));
+	accumulate_scalar(acc + k, x + k, n - k);
+}
+#else
+/* re^2 + im^2 of 4 bins */
+__attribute__((target("avx2")))
+static inline __m256d power4_avx2(const double *s)
+{
+	__m256d a = _mm256_loadu_pd(s), b = _mm256_loadu_pd(s + 4);
+
+	a = _mm256_mul_pd(a, a);
+	b = _mm256_mul_pd(b, b);
+	// hadd leaves bins as 0 2 1 3
+	return _mm256_permute4x64_pd(_mm256_hadd_pd(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+}
+
+__attribute__((target("avx2")))
+static void power_avx2(double *dst, const double *pwr, size_t n, double offset)
+{
+	const __m128 off = _mm_set1_ps(offset);
+	size_t k = 0;
+
+	// the polynomial runs on floats, 4 lanes of the converted doubles
+	for (; k + 4 <= n; k += 4) {
+		__m128 v = fast_db_sse2(_mm256_cvtpd_ps(_mm256_loadu_pd(pwr + k)));
+
+		_mm256_storeu_pd(dst + k, _mm256_cvtps_pd(_mm_add_ps(v, off)));
+	}
+	power_scalar(dst + k, pwr + k, n - k, offset);
+}
+
+__attribute__((target("avx2")))
+static void accumulate_avx2(double *acc, const fft_complex *x, size_t n)
+{
+	const double *s = (const double *)x;
+	size_t k = 0;
+
+	for (; k + 4 <= n; k += 4)
+		_mm256_storeu_pd(acc + k, _mm256_add_pd(_mm256_loadu_pd(acc + k), power4_avx2(s + 2*k)));
+	accumulate_scalar(acc + k, x + k, n - k);
+}
+#endif
+#endif
+
+static const struct db_kernel kernels[] = {
+#ifdef HAVE_X86
+	{ "avx2",   power_avx2,   accumulate_avx2 },
+	{ "sse2",   power_sse2,   accumulate_sse2 },
+#endif
+	{ "scalar", power_scalar, accumulate_scalar },
+};
+
+static const struct db_kernel *active = &kernels[sizeof(kernels)/sizeof(kernels[0]) - 1];
+
+static const char *const modes[] = {
+	[DB_EXACT] = "exact",
+	[DB_FAST]  = "fast",
+};
+
+const char *db_init(void)
+{
+	size_t i;
+
+	// table is ordered widest first
+	for (i = 0; i < sizeof(kernels)/sizeof(kernels[0]); i++) {
+		if (simd_supported(kernels[i].name)) {
+			active = &kernels[i];
+			break;
+		}
+	}
+	return active->name;
+}
+
+bool db_select(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(kernels)/sizeof(kernels[0]); i++) {
+		if (!strcmp(kernels[i].name, name) && simd_supported(kernels[i].name)) {
+			active = &kernels[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+const struct db_kernel *db_kernel(void)
+{
+	return active;
+}
+
+int db_mode_parse(const char *s)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(modes)/sizeof(modes[0]); i++)
+		if (!strcmp(s, modes[i]))
+			return i;
+	return -1;
+}
+
+const char *db_mode_name(enum db_mode mode)
+{
+	return modes[mode];
+}
+
+void db_power(sample_t *dst, const sample_t *pwr, size_t n, sample_t offset, enum db_mode mode)
+{
+	size_t k;
+
+	if (mode == DB_FAST) {
+		active->power(dst, pwr, n, offset);
+		return;
+	}
+	for (k = 0; k < n; k++)
+		dst[k] = 10*LOG10(pwr[k]) + offset;
+}
+
+void db_accumulate(sample_t *acc, const fft_complex *x, size_t n)
+{
+	active->accumulate(acc, x, n);
+}
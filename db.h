@@ -0,0 +1,49 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Power and dB kernels for the post FFT stage
+*/
+
+#ifndef DB_H
+#define DB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "dsp.h"
+
+/*
+	 DB_EXACT calls libm log10 for every bin. DB_FAST splits the float into
+	 exponent and mantissa and evaluates a degree 4 minimax polynomial for
+	 log2 of the mantissa: |error| < 0.0004 dB over the whole float range
+	 (0.0003 dB from the polynomial plus float rounding), far below the
+	 variance of any spectrum estimate. Zero maps to about -382 dB instead
+	 of -inf.
+*/
+enum db_mode {
+	DB_EXACT,
+	DB_FAST,
+};
+
+struct db_kernel {
+	const char *name;
+	void (*power)(sample_t *dst, const sample_t *pwr, size_t n, sample_t offset);
+	void (*accumulate)(sample_t *acc, const fft_complex *x, size_t n);
+};
+
+/* picks the widest kernel the CPU supports, returns its name */
+const char *db_init(void);
+/* forces a kernel by name ("scalar", "sse2", "avx2"), false if unsupported */
+bool db_select(const char *name);
+const struct db_kernel *db_kernel(void);
+
+int db_mode_parse(const char *s);
+const char *db_mode_name(enum db_mode mode);
+
+/* dst[k] = 10*log10(pwr[k]) + offset */
+void db_power(sample_t *dst, const sample_t *pwr, size_t n, sample_t offset, enum db_mode mode);
+
+/* acc[k] += re^2 + im^2, the Welch averaging step */
+void db_accumulate(sample_t *acc, const fft_complex *x, size_t n);
+
+#endif
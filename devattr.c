@@ -0,0 +1,329 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Device configuration: cached, batched IIO channel attribute writes
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "devattr.h"
+
+/* attributes one write changes on every channel of the device, the AD9361 runs RX and TX from one clock */
+static const char *const aliased[] = { "sampling_frequency", NULL };
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void devattr_init(struct devattr_set *set)
+{
+	memset(set, 0, sizeof(*set));
+	set->batch = true;
+}
+
+static struct devattr *find(struct devattr_set *set, const struct iio_channel *chn, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < set->n; i++)
+		if (set->attr[i].chn == chn && !strcmp(set->attr[i].name, name))
+			return &set->attr[i];
+	return NULL;
+}
+
+int devattr_str(struct devattr_set *set, struct iio_channel *chn, const char *name, const char *val)
+{
+	struct devattr *a = find(set, chn, name);
+
+	if (strlen(val) >= DEVATTR_LEN)
+		return -EINVAL;
+	if (!a) {
+		if (set->n == DEVATTR_MAX)
+			return -E2BIG;
+		a = &set->attr[set->n++];
+		memset(a, 0, sizeof(*a));
+		a->chn = chn;
+		a->name = name;
+	}
+	strcpy(a->want, val);
+	return 0;
+}
+
+int devattr_lli(struct devattr_set *set, struct iio_channel *chn, const char *name, long long val)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%lld", val);
+	return devattr_str(set, chn, name, buf);
+}
+
+/* sysfs values end in a newline, the network backend may not terminate them */
+static void set_value(struct devattr *a, const char *val, size_t len)
+{
+	if (len >= DEVATTR_LEN)
+		len = DEVATTR_LEN - 1;
+	memcpy(a->value, val, len);
+	a->value[len] = '\0';
+	len = strcspn(a->value, "\n");
+	a->value[len] = '\0';
+	a->known = true;
+}
+
+static int read_cb(struct iio_channel *chn, const char *attr, const char *val, size_t len, void *d)
+{
+	struct devattr *a = find(d, chn, attr);
+
+	if (a)
+		set_value(a, val, len);
+	return 0;
+}
+
+static ssize_t write_cb(struct iio_channel *chn, const char *attr, void *buf, size_t len, void *d)
+{
+	struct devattr *a = find(d, chn, attr);
+	size_t n;
+
+	// 0 leaves an attribute out of the batch
+	if (!a || !a->dirty)
+		return 0;
+	n = strlen(a->want) + 1;
+	if (n > len)
+		return -ENOMEM;
+	memcpy(buf, a->want, n);
+	return n;
+}
+
+/* attributes of chn in the set that match, number of them */
+static unsigned int count(const struct devattr_set *set, const struct iio_channel *chn, bool unknown, bool dirty)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < set->n; i++)
+		if (set->attr[i].chn == chn && (!unknown || !set->attr[i].known) &&
+			(!dirty || set->attr[i].dirty))
+			n++;
+	return n;
+}
+
+/* index of the first attribute of chn in the set, channels are handled in this order */
+static unsigned int first_index(const struct devattr_set *set, const struct iio_channel *chn)
+{
+	unsigned int j;
+
+	for (j = 0; j < set->n; j++)
+		if (set->attr[j].chn == chn)
+			break;
+	return j;
+}
+
+/* true for the first attribute of its channel in the set, so each channel is handled once */
+static bool first_of_channel(const struct devattr_set *set, unsigned int i)
+{
+	return first_index(set, set->attr[i].chn) == i;
+}
+
+static bool is_aliased(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; aliased[i]; i++)
+		if (!strcmp(aliased[i], name))
+			return true;
+	return false;
+}
+
+static void read_channel(struct devattr_set *set, struct iio_channel *chn)
+{
+	char buf[DEVATTR_LEN];
+	uint64_t t0 = now_ns(), dt;
+	unsigned int i;
+	ssize_t ret;
+
+	if (set->batch) {
+		set->reads++;
+		if (iio_channel_attr_read_all(chn, read_cb, set) < 0)
+			set->batch = false;
+	}
+	// without the batched read, or after it failed, one at a time; unreadable ones are just written
+	for (i = 0; i < set->n; i++) {
+		struct devattr *a = &set->attr[i];
+
+		if (a->chn != chn || a->known)
+			continue;
+		set->reads++;
+		ret = iio_channel_attr_read(chn, a->name, buf, sizeof(buf));
+		if (ret > 0)
+			set_value(a, buf, ret);
+	}
+	dt = now_ns() - t0;
+	for (i = 0; i < set->n; i++)
+		if (set->attr[i].chn == chn)
+			set->attr[i].ns = dt;
+	set->read_ns += dt;
+}
+
+static int write_one(struct devattr_set *set, struct devattr *a)
+{
+	uint64_t t0 = now_ns();
+	ssize_t ret;
+
+	ret = iio_channel_attr_write(a->chn, a->name, a->want);
+	a->ns = now_ns() - t0;
+	set->write_ns += a->ns;
+	if (ret < 0) {
+		set->failed = a;
+		return ret;
+	}
+	return 0;
+}
+
+static int write_channel(struct devattr_set *set, struct iio_channel *chn)
+{
+	uint64_t t0, dt;
+	unsigned int i;
+	int ret;
+
+	if (set->batch && count(set, chn, false, true) > 1) {
+		t0 = now_ns();
+		ret = iio_channel_attr_write_all(chn, write_cb, set);
+		dt = now_ns() - t0;
+		set->write_ns += dt;
+		if (ret >= 0) {
+			set->batches++;
+			for (i = 0; i < set->n; i++)
+				if (set->attr[i].chn == chn && set->attr[i].dirty)
+					set->attr[i].ns = dt;
+			return 0;
+		}
+		// the batch may have been refused as a whole, the single writes tell which one
+		set->batch = false;
+	}
+	for (i = 0; i < set->n; i++) {
+		if (set->attr[i].chn != chn || !set->attr[i].dirty)
+			continue;
+		ret = write_one(set, &set->attr[i]);
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+/* chn's batch made it to the device: that is what it has now */
+static void mark_written(struct devattr_set *set, const struct iio_channel *chn)
+{
+	unsigned int i;
+
+	for (i = 0; i < set->n; i++) {
+		struct devattr *a = &set->attr[i];
+
+		if (a->chn != chn || !a->dirty)
+			continue;
+		strcpy(a->value, a->want);
+		a->known = true;
+		a->dirty = false;
+		a->written = true;
+		a->writes++;
+	}
+}
+
+/*
+	 The values read back before the writes are stale where a write on chn
+	 also changed an aliased attribute of another channel. Those are read
+	 again: a channel still to come is written if it no longer matches, one
+	 already written keeps what the device reports, so the next commit sees
+	 the difference.
+*/
+static void reread_aliases(struct devattr_set *set, const struct iio_channel *chn, unsigned int done)
+{
+	char buf[DEVATTR_LEN];
+	const struct devattr *w;
+	uint64_t t0;
+	unsigned int i;
+	ssize_t ret;
+	bool dirty;
+
+	for (i = 0; i < set->n; i++) {
+		struct devattr *a = &set->attr[i];
+
+		if (a->chn == chn || !is_aliased(a->name))
+			continue;
+		w = find(set, chn, a->name);
+		if (!w || !w->written)
+			continue;
+		t0 = now_ns();
+		set->reads++;
+		ret = iio_channel_attr_read(a->chn, a->name, buf, sizeof(buf));
+		set->read_ns += now_ns() - t0;
+		if (ret > 0)
+			set_value(a, buf, ret);
+		else
+			a->known = false;
+		if (first_index(set, a->chn) <= done)
+			continue;
+		dirty = !a->known || strcmp(a->want, a->value);
+		if (dirty != a->dirty)
+			a->skipped += dirty ? -1 : 1;
+		a->dirty = dirty;
+	}
+}
+
+int devattr_commit(struct devattr_set *set)
+{
+	unsigned int i;
+	int ret;
+
+	set->read_ns = 0;
+	set->write_ns = 0;
+	set->reads = 0;
+	set->batches = 0;
+	set->failed = NULL;
+
+	for (i = 0; i < set->n; i++)
+		if (first_of_channel(set, i) && count(set, set->attr[i].chn, true, false))
+			read_channel(set, set->attr[i].chn);
+
+	for (i = 0; i < set->n; i++) {
+		struct devattr *a = &set->attr[i];
+
+		a->dirty = !a->known || strcmp(a->want, a->value);
+		a->written = false;
+		if (!a->dirty)
+			a->skipped++;
+	}
+
+	for (i = 0; i < set->n; i++) {
+		if (!first_of_channel(set, i) || !count(set, set->attr[i].chn, false, true))
+			continue;
+		ret = write_channel(set, set->attr[i].chn);
+		if (ret < 0)
+			return ret;
+		mark_written(set, set->attr[i].chn);
+		reread_aliases(set, set->attr[i].chn, i);
+	}
+	return 0;
+}
+
+void devattr_report(FILE *fp, const struct devattr_set *set)
+{
+	unsigned int i, written = 0;
+
+	for (i = 0; i < set->n; i++)
+		written += set->attr[i].written;
+	fprintf(fp, "* Device attributes: %u of %u written in %.2f ms (%u batched writes), "
+		"%u reads in %.2f ms\n", written, set->n, set->write_ns / 1e6, set->batches,
+		set->reads, set->read_ns / 1e6);
+	for (i = 0; i < set->n; i++) {
+		const struct devattr *a = &set->attr[i];
+
+		fprintf(fp, "  %-11s %-3s %-18s %-14s %s %8.1f us\n", iio_channel_get_id(a->chn),
+			iio_channel_is_output(a->chn) ? "out" : "in", a->name, a->value,
+			a->written ? "written  " : "unchanged", a->ns / 1e3);
+	}
+}
@@ -0,0 +1,85 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Device configuration: cached, batched IIO channel attribute writes
+*/
+
+#ifndef DEVATTR_H
+#define DEVATTR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __APPLE__
+#include <iio/iio.h>
+#else
+#include <iio.h>
+#endif
+
+#define DEVATTR_MAX 16            // attributes one set can configure
+#define DEVATTR_LEN 64            // longest value kept
+
+struct devattr {
+	struct iio_channel *chn;
+	const char *name;
+	char value[DEVATTR_LEN];      // last known value on the device
+	char want[DEVATTR_LEN];       // value to write on the next commit
+	bool known;                   // value was read back or written
+	bool dirty;                   // want differs from value, or value unknown
+	bool written;                 // the last commit wrote it
+	uint64_t ns;                  // time of the read or write that set value, shared by a batch
+	unsigned int writes;
+	unsigned int skipped;         // writes left out because the device had the value already
+};
+
+/*
+	 Every attribute write is a round trip on the network backend, and the
+	 same settings are sent again on every start. A set collects the
+	 attributes to configure, devattr_commit() reads back the values the
+	 device has with one iio_channel_attr_read_all() per channel, leaves
+	 the ones that already match alone and writes the rest, several on a
+	 channel in one iio_channel_attr_write_all(). Backends without the
+	 batched calls fall back to one attribute at a time.
+
+	 A channel's batch is written in the driver's attribute order, so
+	 attributes that depend on each other belong on different channels,
+	 or in separate commits. Values are compared as text: a driver that
+	 rounds what it is given reads back differently and is written again.
+
+	 All channels are read back before the first write, but some
+	 attributes are one setting behind several channels: on the AD9361
+	 writing sampling_frequency on the RX voltage channel changes the TX
+	 one too. After a channel's writes, those aliased attributes of the
+	 other channels in the set are read again, so a later channel is still
+	 written when the alias moved it away from its value, and an earlier
+	 one reports what the device ended up with.
+*/
+struct devattr_set {
+	struct devattr attr[DEVATTR_MAX];
+	unsigned int n;
+	bool batch;                   // try the *_attr_*_all calls, cleared when they fail
+	uint64_t read_ns;             // read back time of the last commit
+	uint64_t write_ns;            // write time of the last commit
+	unsigned int reads;           // round trips of the last commit
+	unsigned int batches;
+	const struct devattr *failed; // attribute the last commit stopped on
+};
+
+void devattr_init(struct devattr_set *set);
+
+/* queues a value for chn's attribute name, name must outlive the set; -E2BIG when full */
+int devattr_str(struct devattr_set *set, struct iio_channel *chn, const char *name, const char *val);
+int devattr_lli(struct devattr_set *set, struct iio_channel *chn, const char *name, long long val);
+
+/*
+	 Writes what changed, channel by channel in the order they were first
+	 queued. Stops on the first IIO error, returned as negative errno with
+	 failed pointing at the attribute.
+*/
+int devattr_commit(struct devattr_set *set);
+
+/* one line per attribute: value, written or unchanged, and the latency */
+void devattr_report(FILE *fp, const struct devattr_set *set);
+
+#endif
@@ -0,0 +1,36 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * DSP precision selection, build with -DSPECTRUM_SINGLE for float32
+*/
+
+#ifndef DSP_H
+#define DSP_H
+
+#include <complex.h>
+#include <fftw3.h>
+
+/*
+	 The AD9361 delivers 12 bit samples, float has 24 bits of mantissa so
+	 single precision loses nothing at the input and halves the memory
+	 traffic of every stage. Double stays the default.
+*/
+#ifdef SPECTRUM_SINGLE
+typedef float sample_t;
+typedef fftwf_complex fft_complex;
+typedef fftwf_plan fft_plan;
+#define FFTW(name) fftwf_ ## name
+#define PRECISION_NAME "single"
+#define LOG10 log10f
+#define CABS cabsf
+#else
+typedef double sample_t;
+typedef fftw_complex fft_complex;
+typedef fftw_plan fft_plan;
+#define FFTW(name) fftw_ ## name
+#define PRECISION_NAME "double"
+#define LOG10 log10
+#define CABS cabs
+#endif
+
+#endif
@@ -0,0 +1,153 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * AD9361 fastlock: LO hops from stored synthesizer calibrations
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fastlock.h"
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int write_slot(struct iio_channel *lo, const char *attr, unsigned int slot)
+{
+	char val[16];
+	ssize_t ret;
+
+	snprintf(val, sizeof(val), "%u", slot);
+	ret = iio_channel_attr_write(lo, attr, val);
+	return ret < 0 ? ret : 0;
+}
+
+/* tunes to freq, which calibrates, and keeps the calibration in slot and in prof */
+static int calibrate(struct fastlock *fl, unsigned int slot, struct fastlock_profile *prof)
+{
+	char buf[128], *data;
+	ssize_t ret;
+
+	ret = iio_channel_attr_write_longlong(fl->lo, "frequency", llround(prof->freq_hz));
+	if (ret < 0)
+		return ret;
+	ret = write_slot(fl->lo, "fastlock_store", slot);
+	if (ret < 0)
+		return ret;
+
+	// fastlock_save selects a slot on write and reads back as "SLOT v0,...,v15"
+	ret = write_slot(fl->lo, "fastlock_save", slot);
+	if (ret < 0)
+		return ret;
+	ret = iio_channel_attr_read(fl->lo, "fastlock_save", buf, sizeof(buf));
+	if (ret < 0)
+		return ret;
+	data = strchr(buf, ' ');
+	if (!data || strlen(data + 1) >= sizeof(prof->data))
+		return -EINVAL;
+	strcpy(prof->data, data + 1);
+	data = strchr(prof->data, '\n');
+	if (data)
+		*data = '\0';
+	return 0;
+}
+
+int fastlock_init(struct fastlock *fl, struct iio_channel *lo, const double *freq, unsigned int n)
+{
+	uint64_t t0 = now_ns();
+	unsigned int i;
+	int ret;
+
+	memset(fl, 0, sizeof(*fl));
+	fl->lo = lo;
+	fl->active = -1;
+	for (i = 0; i < FASTLOCK_SLOTS; i++)
+		fl->slot[i] = -1;
+	if (!lo || !n)
+		return -EINVAL;
+	if (!iio_channel_find_attr(lo, "fastlock_store") || !iio_channel_find_attr(lo, "fastlock_recall") ||
+		!iio_channel_find_attr(lo, "fastlock_save") || !iio_channel_find_attr(lo, "fastlock_load"))
+		return -ENOSYS;
+
+	fl->prof = calloc(n, sizeof(*fl->prof));
+	if (!fl->prof)
+		return -ENOMEM;
+	fl->nprof = n;
+	// the last FASTLOCK_SLOTS frequencies calibrated are the ones left resident
+	for (i = 0; i < n; i++) {
+		fl->prof[i].freq_hz = freq[i];
+		ret = calibrate(fl, i % FASTLOCK_SLOTS, &fl->prof[i]);
+		if (ret < 0) {
+			fastlock_free(fl);
+			return ret;
+		}
+		fl->slot[i % FASTLOCK_SLOTS] = i;
+	}
+	fl->init_seconds = (now_ns() - t0) / 1e9;
+	return 0;
+}
+
+static int find_profile(const struct fastlock *fl, double freq)
+{
+	unsigned int i;
+
+	// profiles are calibrated for the exact LO plan, a sub Hz difference is rounding
+	for (i = 0; i < fl->nprof; i++)
+		if (fabs(fl->prof[i].freq_hz - freq) < 0.5)
+			return i;
+	return -1;
+}
+
+int fastlock_tune(struct fastlock *fl, double freq)
+{
+	char val[FASTLOCK_DATA_LEN + 16];
+	int p = find_profile(fl, freq);
+	uint64_t t0, dt;
+	int slot, i, ret;
+
+	if (p < 0)
+		return -ENOENT;
+	t0 = now_ns();
+	for (slot = 0; slot < FASTLOCK_SLOTS; slot++)
+		if (fl->slot[slot] == p)
+			break;
+	if (slot == FASTLOCK_SLOTS) {
+		// not resident: overwrite the least recently used slot, never the one the LO runs from
+		slot = -1;
+		for (i = 0; i < FASTLOCK_SLOTS; i++)
+			if (i != fl->active && (slot < 0 || fl->used[i] < fl->used[slot]))
+				slot = i;
+		snprintf(val, sizeof(val), "%d %s", slot, fl->prof[p].data);
+		ret = iio_channel_attr_write(fl->lo, "fastlock_load", val);
+		if (ret < 0)
+			return ret;
+		fl->slot[slot] = p;
+		fl->loads++;
+	}
+	ret = write_slot(fl->lo, "fastlock_recall", slot);
+	if (ret < 0)
+		return ret;
+	fl->active = slot;
+	fl->used[slot] = ++fl->hops;
+	dt = now_ns() - t0;
+	fl->hop_ns += dt;
+	if (dt > fl->hop_max_ns)
+		fl->hop_max_ns = dt;
+	return 0;
+}
+
+void fastlock_free(struct fastlock *fl)
+{
+	free(fl->prof);
+	fl->prof = NULL;
+	fl->nprof = 0;
+}
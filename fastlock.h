@@ -0,0 +1,74 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * AD9361 fastlock: LO hops from stored synthesizer calibrations
+*/
+
+#ifndef FASTLOCK_H
+#define FASTLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __APPLE__
+#include <iio/iio.h>
+#else
+#include <iio.h>
+#endif
+
+#define FASTLOCK_SLOTS 8          // profiles the AD9361 holds per synthesizer
+#define FASTLOCK_DATA_LEN 96      // "v0,...,v15", the 16 words of one profile
+
+/* a calibrated LO frequency, kept on the host */
+struct fastlock_profile {
+	double freq_hz;
+	char data[FASTLOCK_DATA_LEN];
+};
+
+/*
+	 A plain write of the LO "frequency" attribute runs the full VCO and
+	 charge pump calibration, milliseconds per retune. The AD9361 keeps up
+	 to FASTLOCK_SLOTS calibrated profiles per synthesizer and switches to
+	 one with a single fastlock_recall write, no calibration.
+
+	 fastlock_init() tunes to every frequency once, stores the calibration
+	 into a slot with fastlock_store and reads it back through
+	 fastlock_save, so the host holds a profile for every frequency. Up to
+	 FASTLOCK_SLOTS frequencies stay resident and every hop is a recall;
+	 with more, a hop to a profile that isn't resident first writes it
+	 into the least recently used slot with fastlock_load, which is a
+	 register load, still no calibration.
+*/
+struct fastlock {
+	struct iio_channel *lo;       // altvoltage0 (RX LO) or altvoltage1 (TX LO) of ad9361-phy
+	struct fastlock_profile *prof;
+	unsigned int nprof;
+	int slot[FASTLOCK_SLOTS];      // profile resident in each slot, -1 for none
+	uint64_t used[FASTLOCK_SLOTS]; // last hop that used the slot, for LRU
+	int active;                   // slot the LO runs from, -1 before the first hop
+	uint64_t hops;
+	uint64_t loads;               // hops that had to load a slot first
+	uint64_t hop_ns;              // time spent hopping, the attribute writes
+	uint64_t hop_max_ns;          // slowest hop
+	double init_seconds;          // calibration time of all profiles
+};
+
+/*
+	 Calibrates and stores a profile for each of the n frequencies. Needs
+	 a driver with the fastlock attributes, -ENOSYS without them; other
+	 IIO errors are returned as they are. The LO is left at the last
+	 frequency.
+*/
+int fastlock_init(struct fastlock *fl, struct iio_channel *lo, const double *freq, unsigned int n);
+
+/*
+	 Hops to freq, -ENOENT if it has no profile, the caller then writes the
+	 frequency. The hop is timed from the first write to the recall
+	 returning, there is no lock detect to read; the PLL is locked a fixed
+	 few tens of microseconds after the recall lands.
+*/
+int fastlock_tune(struct fastlock *fl, double freq);
+
+void fastlock_free(struct fastlock *fl);
+
+#endif
@@ -0,0 +1,151 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * FFT benchmark: throughput and speedup per FFT size and thread count
+*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dsp.h"
+#include "fftplan.h"
+
+#define RX_FS 30.72e6          // real time budget, samples per second
+#define BUFFER_SAMPLES (1024*1024)
+#define FFT_BATCH_BELOW 65536  // same rule as the spectrum tool
+
+static const size_t sizes[] = { 16384, 65536, 262144, 1024*1024 };
+
+static enum plan_rigor plan_rigor = PLAN_MEASURE;
+static int max_threads;
+static double seconds = 0.5;
+
+static void usage(int argc, char *argv[])
+{
+	printf("Usage: %s [OPTION]\n", argv[0]);
+	printf("  -p\tFFT planner rigor: estimate, measure, patient, exhaustive (default measure)\n");
+	printf("  -w\tFFTW wisdom cache directory (default ~/.cache/spectrum)\n");
+	printf("  -t\tmaximum thread count (default one per CPU)\n");
+	printf("  -s\tseconds to run each point (default 0.5)\n");
+}
+
+static void parse_options(int argc, char *argv[])
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "p:w:t:s:h")) != -1) {
+		switch (c)
+		{
+		case 'p':
+			if (fftplan_rigor_parse(optarg) < 0) {
+				usage(argc, argv);
+				exit(1);
+			}
+			plan_rigor = fftplan_rigor_parse(optarg);
+			break;
+		case 'w':
+			fftplan_set_cache_dir(optarg);
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 's':
+			seconds = atof(optarg);
+			break;
+		case 'h':
+		default:
+			usage(argc, argv);
+			exit(1);
+		}
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* samples per second transformed by n x batch on the given thread count */
+static double run_point(size_t n, size_t batch, int threads, fft_complex *in, fft_complex *out)
+{
+	struct plan_info pinfo;
+	fft_plan plan;
+	double t0, t;
+	size_t k, runs = 0;
+
+	fftplan_set_threads(threads);
+	plan = fftplan_dft_batch(n, batch, in, out, plan_rigor, &pinfo);
+	if (!plan)
+		return 0;
+
+	// planning may have scribbled over the input
+	for (k = 0; k < n * batch; k++)
+		in[k] = (sample_t)(rand() % 4096 - 2048) + (sample_t)(rand() % 4096 - 2048) * I;
+
+	FFTW(execute)(plan); // warm up caches
+	t0 = now();
+	do {
+		FFTW(execute)(plan);
+		runs++;
+		t = now() - t0;
+	} while (t < seconds);
+
+	FFTW(destroy_plan)(plan);
+	return runs * n * batch / t;
+}
+
+int main(int argc, char **argv)
+{
+	fft_complex *in, *out;
+	size_t i;
+	int t;
+
+	parse_options(argc, argv);
+	if (max_threads <= 0)
+		max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (max_threads <= 0)
+		max_threads = 1;
+
+	in = FFTW(malloc)(sizeof(fft_complex) * BUFFER_SAMPLES);
+	out = FFTW(malloc)(sizeof(fft_complex) * BUFFER_SAMPLES);
+	if (!in || !out) {
+		perror("Could not allocate FFT buffers");
+		return 1;
+	}
+
+	printf("* %s precision, %s plans, up to %d threads, real time = %.2f MS/s\n",
+		PRECISION_NAME, fftplan_rigor_name(plan_rigor), max_threads, RX_FS / 1e6);
+	printf("%9s %6s %8s %10s %8s %8s\n", "size", "batch", "threads", "MS/s", "speedup", "x rt");
+
+	for (i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+		size_t n = sizes[i];
+		size_t batch = n < FFT_BATCH_BELOW ? BUFFER_SAMPLES / n : 1;
+		double base = 0;
+
+		// 1, 2, 4, ... threads, always ending on max_threads
+		for (t = 1; ; t *= 2) {
+			double rate;
+
+			if (t > max_threads)
+				t = max_threads;
+			rate = run_point(n, batch, t, in, out);
+			if (t == 1)
+				base = rate;
+			printf("%9zu %6zu %8d %10.2f %8.2f %8.2f\n", n, batch, t, rate / 1e6,
+				base > 0 ? rate / base : 0, rate / RX_FS);
+			if (t == max_threads)
+				break;
+		}
+	}
+
+	FFTW(free)(in);
+	FFTW(free)(out);
+	return 0;
+}
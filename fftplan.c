@@ -0,0 +1,181 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * FFTW planning with a persistent wisdom cache
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fftplan.h"
+
+static const char *cache_dir;
+static int threads = 1;
+
+static const struct {
+	const char *name;
+	unsigned int flags;
+} rigors[] = {
+	[PLAN_ESTIMATE]   = { "estimate",   FFTW_ESTIMATE },
+	[PLAN_MEASURE]    = { "measure",    FFTW_MEASURE },
+	[PLAN_PATIENT]    = { "patient",    FFTW_PATIENT },
+	[PLAN_EXHAUSTIVE] = { "exhaustive", FFTW_EXHAUSTIVE },
+};
+
+int fftplan_rigor_parse(const char *s)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(rigors)/sizeof(rigors[0]); i++)
+		if (!strcmp(s, rigors[i].name))
+			return i;
+	return -1;
+}
+
+const char *fftplan_rigor_name(enum plan_rigor r)
+{
+	return rigors[r].name;
+}
+
+void fftplan_set_cache_dir(const char *dir)
+{
+	cache_dir = dir;
+}
+
+int fftplan_set_threads(int nthreads)
+{
+	static bool initialised;
+
+	if (nthreads <= 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads <= 0)
+		nthreads = 1;
+
+	if (!initialised) {
+		if (!FFTW(init_threads)())
+			return threads;
+		initialised = true;
+	}
+	FFTW(plan_with_nthreads)(nthreads);
+	threads = nthreads;
+	return threads;
+}
+
+/* FNV-1a over the CPU model string, wisdom is only valid on the same CPU */
+static uint32_t cpu_key(void)
+{
+	char line[256];
+	uint32_t h = 2166136261u;
+	FILE *fp;
+
+	fp = fopen("/proc/cpuinfo", "r");
+	if (!fp)
+		return 0;
+	while (fgets(line, sizeof(line), fp)) {
+		if (!strncmp(line, "model name", 10) || !strncmp(line, "Processor", 9) ||
+				!strncmp(line, "CPU part", 8)) {
+			const char *c;
+
+			for (c = line; *c; c++)
+				h = (h ^ (unsigned char)*c) * 16777619u;
+			break;
+		}
+	}
+	fclose(fp);
+	return h;
+}
+
+/* mkdir -p for the cache directory, ignores errors (planning still works) */
+static void make_dirs(char *path)
+{
+	char *p;
+
+	for (p = path + 1; *p; p++) {
+		if (*p == '/') {
+			*p = '\0';
+			mkdir(path, 0755);
+			*p = '/';
+		}
+	}
+	mkdir(path, 0755);
+}
+
+void fftplan_cache_path(char *buf, size_t len, const char *name)
+{
+	char dir[192];
+	const char *env;
+
+	if (cache_dir)
+		snprintf(dir, sizeof(dir), "%s", cache_dir);
+	else if ((env = getenv("XDG_CACHE_HOME")) && *env)
+		snprintf(dir, sizeof(dir), "%s/spectrum", env);
+	else if ((env = getenv("HOME")) && *env)
+		snprintf(dir, sizeof(dir), "%s/.cache/spectrum", env);
+	else
+		snprintf(dir, sizeof(dir), ".");
+
+	make_dirs(dir);
+	snprintf(buf, len, "%s/%s", dir, name);
+}
+
+static void wisdom_path(char *buf, size_t len, size_t n)
+{
+	char name[64];
+
+	snprintf(name, sizeof(name), "wisdom-%08x-%s-%zu.fftw", cpu_key(), PRECISION_NAME, n);
+	fftplan_cache_path(buf, len, name);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+fft_plan fftplan_dft_1d(size_t n, fft_complex *in, fft_complex *out,
+		enum plan_rigor rigor, struct plan_info *info)
+{
+	return fftplan_dft_batch(n, 1, in, out, rigor, info);
+}
+
+fft_plan fftplan_dft_batch(size_t n, size_t howmany, fft_complex *in, fft_complex *out,
+		enum plan_rigor rigor, struct plan_info *info)
+{
+	const int dims = n;
+	unsigned int flags = rigors[rigor].flags;
+	struct plan_info local;
+	fft_plan plan = NULL;
+	double t0 = now();
+
+	if (!info)
+		info = &local;
+	memset(info, 0, sizeof(*info));
+	wisdom_path(info->path, sizeof(info->path), n);
+
+	// ESTIMATE never measures, so there's nothing worth caching
+	if (rigor != PLAN_ESTIMATE) {
+		FFTW(import_wisdom_from_filename)(info->path);
+		plan = FFTW(plan_many_dft)(1, &dims, howmany, in, NULL, 1, n, out, NULL, 1, n,
+			FFTW_FORWARD, flags | FFTW_WISDOM_ONLY);
+		info->from_wisdom = plan != NULL;
+	}
+
+	if (!plan) {
+		plan = FFTW(plan_many_dft)(1, &dims, howmany, in, NULL, 1, n, out, NULL, 1, n,
+			FFTW_FORWARD, flags);
+		if (plan && rigor != PLAN_ESTIMATE)
+			info->saved = FFTW(export_wisdom_to_filename)(info->path) != 0;
+	}
+
+	info->threads = threads;
+	info->seconds = now() - t0;
+	return plan;
+}
@@ -0,0 +1,61 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * FFTW planning with a persistent wisdom cache
+*/
+
+#ifndef FFTPLAN_H
+#define FFTPLAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "dsp.h"
+
+/* how hard FFTW looks for a fast plan, see FFTW_ESTIMATE etc. */
+enum plan_rigor {
+	PLAN_ESTIMATE,
+	PLAN_MEASURE,
+	PLAN_PATIENT,
+	PLAN_EXHAUSTIVE,
+};
+
+struct plan_info {
+	double seconds;     // time spent planning
+	bool from_wisdom;   // plan came out of the cache, no measuring needed
+	bool saved;         // new wisdom was written back to the cache
+	int threads;        // FFTW threads the plan runs on
+	char path[256];     // wisdom file used for this transform
+};
+
+/* parses "estimate", "measure", "patient" or "exhaustive", -1 if unknown */
+int fftplan_rigor_parse(const char *s);
+const char *fftplan_rigor_name(enum plan_rigor r);
+
+/* cache directory, NULL selects $XDG_CACHE_HOME/spectrum or ~/.cache/spectrum */
+void fftplan_set_cache_dir(const char *dir);
+
+/* path of file name in the cache directory, the directory is created if missing */
+void fftplan_cache_path(char *buf, size_t len, const char *name);
+
+/*
+	 Threads used by plans created from now on, 0 means one per online CPU.
+	 Returns the thread count in effect. A single large transform is split
+	 across threads by FFTW, a batch is spread one transform per thread.
+*/
+int fftplan_set_threads(int nthreads);
+
+/*
+	 Creates a 1D complex forward plan. The wisdom file for this size,
+	 precision and CPU is loaded first, if it already holds a plan of at
+	 least the requested rigor no measuring happens. Otherwise the plan is
+	 measured and the wisdom written back, so the next start is instant.
+*/
+fft_plan fftplan_dft_1d(size_t n, fft_complex *in, fft_complex *out,
+		enum plan_rigor rigor, struct plan_info *info);
+
+/* howmany back to back transforms of n points, frame k starts at in + k*n */
+fft_plan fftplan_dft_batch(size_t n, size_t howmany, fft_complex *in, fft_complex *out,
+		enum plan_rigor rigor, struct plan_info *info);
+
+#endif
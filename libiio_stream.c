@@ -2,14 +2,13 @@
 #include <iio.h>
 #include <math.h>
 #include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-float dither(float f)
-{
-	float r1 = (float)rand() / (float)RAND_MAX;
-	float r2 = (float)rand() / (float)RAND_MAX;
-
-	return f + (r1 - r2) * 16.0f;
-}
+#include "nco.h"
+#include "noise.h"
 
 int main(void)
 {
@@ -18,6 +17,8 @@ int main(void)
 	struct iio_buffer *txbuf;
 	unsigned int i, num_channels;
 	int16_t *buf, *sine;
+	struct nco nco;
+	struct noise dither;
 
 	ctx = iio_create_local_context();
 	if (!ctx) {
@@ -43,10 +44,16 @@ int main(void)
 
 	sine = malloc(sizeof(int16_t) * 1024 * 256 * 2);
 
-	for (i = 0; i < 1024 * 256; i++) {
-		sine[i*2 + 0] = dither(cos(2 * M_PI * i / 256.0) * 0x4000);
-		sine[i*2 + 1] = dither(sin(2 * M_PI * i / 256.0) * 0x4000);
-	}
+	// one cycle every 256 samples, exactly 2^24 of the 2^32 phase turn
+	nco_init();
+	nco_reset(&nco, 256);
+	nco_add_step(&nco, 1u << 24, 0x4000);
+	nco_generate(&nco, sine, 1024 * 256);
+
+	// +-16 codes of TPDF dither
+	noise_init();
+	noise_seed(&dither, 1);
+	noise_dither(&dither, sine, 1024 * 256 * 2, 16.0f);
 
 	while (1) {
 		buf = iio_buffer_start(txbuf);
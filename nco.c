@@ -0,0 +1,242 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Numerically controlled oscillator: int16 I/Q tones from a phase accumulator
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#include "nco.h"
+#include "simd.h"
+
+#define LUT_BITS 12
+#define LUT_SIZE (1 << LUT_BITS)
+#define FRAC_SCALE (1.0f / 65536)   // 16 interpolation bits below the index
+#define CHUNK 256                   // samples summed in float before packing
+
+/* one turn of sine plus a guard entry so i + 1 never wraps */
+static float sin_tab[LUT_SIZE + 1];
+static bool tab_ready;
+
+static void make_table(void)
+{
+	int i;
+
+	if (tab_ready)
+		return;
+	for (i = 0; i <= LUT_SIZE; i++)
+		sin_tab[i] = sin(2 * M_PI * i / LUT_SIZE);
+	tab_ready = true;
+}
+
+static inline float lut(uint32_t i, float f)
+{
+	return sin_tab[i] + f * (sin_tab[i + 1] - sin_tab[i]);
+}
+
+static void tone_scalar(float *re, float *im, size_t n, uint32_t p, uint32_t step, float ampl)
+{
+	size_t k;
+
+	for (k = 0; k < n; k++) {
+		uint32_t i = p >> (32 - LUT_BITS);
+		float f = ((p >> (16 - LUT_BITS)) & 0xffff) * FRAC_SCALE;
+
+		// cos is sin a quarter turn on
+		re[k] += ampl * lut((i + LUT_SIZE/4) & (LUT_SIZE - 1), f);
+		im[k] += ampl * lut(i, f);
+		p += step;
+	}
+}
+
+static void pack_scalar(int16_t *iq, const float *re, const float *im, size_t n)
+{
+	size_t k;
+
+	for (k = 0; k < n; k++) {
+		long i = lrintf(re[k]), q = lrintf(im[k]);
+
+		iq[2*k]     = i > INT16_MAX ? INT16_MAX : i < INT16_MIN ? INT16_MIN : i;
+		iq[2*k + 1] = q > INT16_MAX ? INT16_MAX : q < INT16_MIN ? INT16_MIN : q;
+	}
+}
+
+#ifdef HAVE_X86
+/* 8 phases at once, the table lookups are gathers so there is no SSE2 version */
+__attribute__((target("avx2")))
+static inline __m256 lut_avx2(__m256i i, __m256 f)
+{
+	__m256 t0 = _mm256_i32gather_ps(sin_tab, i, 4);
+	__m256 t1 = _mm256_i32gather_ps(sin_tab + 1, i, 4);
+
+	return _mm256_add_ps(t0, _mm256_mul_ps(f, _mm256_sub_ps(t1, t0)));
+}
+
+__attribute__((target("avx2")))
+static void tone_avx2(float *re, float *im, size_t n, uint32_t p, uint32_t step, float ampl)
+{
+	const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i mask = _mm256_set1_epi32(LUT_SIZE - 1);
+	const __m256i quarter = _mm256_set1_epi32(LUT_SIZE/4);
+	const __m256i frac = _mm256_set1_epi32(0xffff);
+	const __m256i step8 = _mm256_set1_epi32(step * 8);
+	const __m256 a = _mm256_set1_ps(ampl);
+	__m256i vp = _mm256_add_epi32(_mm256_set1_epi32(p),
+		_mm256_mullo_epi32(_mm256_set1_epi32(step), lane));
+	size_t k = 0;
+
+	for (; k + 8 <= n; k += 8) {
+		__m256i i = _mm256_srli_epi32(vp, 32 - LUT_BITS);
+		__m256 f = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(
+			_mm256_srli_epi32(vp, 16 - LUT_BITS), frac)), _mm256_set1_ps(FRAC_SCALE));
+		__m256i c = _mm256_and_si256(_mm256_add_epi32(i, quarter), mask);
+
+		_mm256_storeu_ps(re + k, _mm256_add_ps(_mm256_loadu_ps(re + k),
+			_mm256_mul_ps(a, lut_avx2(c, f))));
+		_mm256_storeu_ps(im + k, _mm256_add_ps(_mm256_loadu_ps(im + k),
+			_mm256_mul_ps(a, lut_avx2(i, f))));
+		vp = _mm256_add_epi32(vp, step8);
+	}
+	tone_scalar(re + k, im + k, n - k, p + (uint32_t)k * step, step, ampl);
+}
+
+__attribute__((target("avx2")))
+static void pack_avx2(int16_t *iq, const float *re, const float *im, size_t n)
+{
+	size_t k = 0;
+
+	for (; k + 8 <= n; k += 8) {
+		__m256i i = _mm256_cvtps_epi32(_mm256_loadu_ps(re + k));
+		__m256i q = _mm256_cvtps_epi32(_mm256_loadu_ps(im + k));
+
+		// unpack gives I0 Q0 I1 Q1 | I4 Q4 I5 Q5 and I2 Q2 I3 Q3 | I6 Q6 I7 Q7,
+		// the in-lane saturating pack then lands everything in order
+		_mm256_storeu_si256((__m256i *)(iq + 2*k), _mm256_packs_epi32(
+			_mm256_unpacklo_epi32(i, q), _mm256_unpackhi_epi32(i, q)));
+	}
+	pack_scalar(iq + 2*k, re + k, im + k, n - k);
+}
+#endif
+
+static const struct nco_kernel kernels[] = {
+#ifdef HAVE_X86
+	{ "avx2",   tone_avx2,   pack_avx2 },
+#endif
+	{ "scalar", tone_scalar, pack_scalar },
+};
+
+static const struct nco_kernel *active = &kernels[sizeof(kernels)/sizeof(kernels[0]) - 1];
+
+const char *nco_init(void)
+{
+	size_t i;
+
+	make_table();
+	// table is ordered widest first
+	for (i = 0; i < sizeof(kernels)/sizeof(kernels[0]); i++) {
+		if (simd_supported(kernels[i].name)) {
+			active = &kernels[i];
+			break;
+		}
+	}
+	return active->name;
+}
+
+bool nco_select(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(kernels)/sizeof(kernels[0]); i++) {
+		if (!strcmp(kernels[i].name, name) && simd_supported(kernels[i].name)) {
+			active = &kernels[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+const struct nco_kernel *nco_kernel(void)
+{
+	return active;
+}
+
+void nco_reset(struct nco *n, double fs)
+{
+	make_table();
+	memset(n, 0, sizeof(*n));
+	n->fs_hz = fs;
+}
+
+uint32_t nco_step(double fs, double freq)
+{
+	double turns;
+
+	// anyone asking for a step is about to use the table
+	make_table();
+	// wrap into one turn first, negative frequencies become the top half
+	turns = freq / fs - floor(freq / fs);
+
+	return (uint32_t)(uint64_t)llround(turns * 4294967296.0);
+}
+
+int nco_add_step(struct nco *n, uint32_t step, double ampl)
+{
+	struct nco_tone *t;
+
+	if (n->ntones == NCO_MAX_TONES)
+		return -ENOSPC;
+	t = &n->tone[n->ntones];
+	t->phase = 0;
+	t->step = step;
+	t->ampl = ampl;
+	return n->ntones++;
+}
+
+int nco_add_tone(struct nco *n, double freq, double ampl)
+{
+	return nco_add_step(n, nco_step(n->fs_hz, freq), ampl);
+}
+
+double nco_freq(const struct nco *n, unsigned int tone)
+{
+	double f = n->tone[tone].step * n->fs_hz / 4294967296.0;
+
+	return f >= n->fs_hz / 2 ? f - n->fs_hz : f;
+}
+
+void nco_sincos(const uint32_t *phase, float *c, float *s, size_t n)
+{
+	size_t k;
+
+	for (k = 0; k < n; k++) {
+		uint32_t i = phase[k] >> (32 - LUT_BITS);
+		float f = ((phase[k] >> (16 - LUT_BITS)) & 0xffff) * FRAC_SCALE;
+
+		c[k] = lut((i + LUT_SIZE/4) & (LUT_SIZE - 1), f);
+		s[k] = lut(i, f);
+	}
+}
+
+void nco_generate(struct nco *n, int16_t *iq, size_t nsamples)
+{
+	float re[CHUNK], im[CHUNK];
+	unsigned int t;
+
+	while (nsamples) {
+		size_t m = nsamples < CHUNK ? nsamples : CHUNK;
+
+		memset(re, 0, sizeof(float) * m);
+		memset(im, 0, sizeof(float) * m);
+		for (t = 0; t < n->ntones; t++) {
+			struct nco_tone *tn = &n->tone[t];
+
+			active->tone(re, im, m, tn->phase, tn->step, tn->ampl);
+			tn->phase += (uint32_t)m * tn->step;
+		}
+		active->pack(iq, re, im, m);
+		iq += 2 * m;
+		nsamples -= m;
+	}
+}
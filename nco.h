@@ -0,0 +1,73 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Numerically controlled oscillator: int16 I/Q tones from a phase accumulator
+*/
+
+#ifndef NCO_H
+#define NCO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define NCO_MAX_TONES 4
+
+/*
+	 Phase is a 32 bit accumulator, one turn = 2^32, so it wraps for free
+	 and never drifts: the frequency resolution is fs / 2^32 (7 mHz at
+	 30.72 MS/s) and the phase after n samples is exact. The top 12 bits
+	 index a sine table, the next 16 interpolate linearly between entries,
+	 spurs stay below -130 dBc, well under the int16 output quantisation.
+*/
+struct nco_tone {
+	uint32_t phase;
+	uint32_t step;       // phase increment per sample
+	float ampl;          // peak, in output codes
+};
+
+struct nco {
+	double fs_hz;
+	unsigned int ntones;
+	struct nco_tone tone[NCO_MAX_TONES];
+};
+
+/* adds ampl * (cos + j sin) of a tone at phase p (one turn = 2^32) to re/im */
+typedef void (*nco_tone_fn)(float *re, float *im, size_t n, uint32_t p, uint32_t step,
+		float ampl);
+/* rounds, saturates and interleaves re/im into int16 I/Q */
+typedef void (*nco_pack_fn)(int16_t *iq, const float *re, const float *im, size_t n);
+
+struct nco_kernel {
+	const char *name;
+	nco_tone_fn tone;
+	nco_pack_fn pack;
+};
+
+/* picks the widest kernel the CPU supports, returns its name */
+const char *nco_init(void);
+/* forces a kernel by name ("scalar", "avx2"), false if unsupported */
+bool nco_select(const char *name);
+const struct nco_kernel *nco_kernel(void);
+
+/* removes all tones */
+void nco_reset(struct nco *n, double fs);
+
+/* phase increment for freq at fs, negative frequencies wrap to the top half */
+uint32_t nco_step(double fs, double freq);
+
+/* adds a tone, returns its index or -ENOSPC; ampl is the peak in codes */
+int nco_add_tone(struct nco *n, double freq, double ampl);
+/* same with an exact phase increment, for waveforms that must wrap seamlessly */
+int nco_add_step(struct nco *n, uint32_t step, double ampl);
+
+/* frequency a tone really has, step * fs / 2^32 */
+double nco_freq(const struct nco *n, unsigned int tone);
+
+/* cos and sin of n arbitrary phases (one turn = 2^32) from the same table, after nco_step() */
+void nco_sincos(const uint32_t *phase, float *c, float *s, size_t n);
+
+/* writes nsamples interleaved I/Q pairs, the sum of all tones, and advances the phases */
+void nco_generate(struct nco *n, int16_t *iq, size_t nsamples);
+
+#endif
@@ -0,0 +1,349 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Noise and dither: xoshiro128+ PRNG with uniform, TPDF and Gaussian blocks
+*/
+
+#include <math.h>
+#include <string.h>
+
+#include "noise.h"
+#include "simd.h"
+
+#define U24 (1.0f / 16777216)            // top 24 bits of a draw to [0, 1)
+#define LN2 0.693147180559945f
+#define HALF_PI 1.57079632679490f
+#define QUARTER_PI 0.785398163397448f
+#define SQRT_HALF 0.707106781186548f
+#define DITHER_CHUNK 256
+
+/* xoshiro128+ on every lane, returns s0 + s3 before the step */
+static inline void next8_scalar(struct noise *n, uint32_t *x)
+{
+	int k;
+
+	for (k = 0; k < NOISE_LANES; k++) {
+		uint32_t s0 = n->s[0][k], s1 = n->s[1][k], s2 = n->s[2][k], s3 = n->s[3][k];
+		uint32_t t = s1 << 9;
+
+		x[k] = s0 + s3;
+		s2 ^= s0;
+		s3 ^= s1;
+		s1 ^= s2;
+		s0 ^= s3;
+		s2 ^= t;
+		n->s[0][k] = s0;
+		n->s[1][k] = s1;
+		n->s[2][k] = s2;
+		n->s[3][k] = (s3 << 11) | (s3 >> 21);
+	}
+}
+
+/* ln(u) for u in (0, 1]: exponent plus 2 atanh((m - 1)/(m + 1)), |error| < 2e-6 */
+static inline float ln_scalar(float u)
+{
+	union { float f; uint32_t i; } v = { u };
+	float e = (float)((int32_t)(v.i >> 23) - 127);
+	float m, s, s2;
+
+	v.i = (v.i & 0x7fffff) | 0x3f800000;
+	m = v.f;
+	s = (m - 1.0f) / (m + 1.0f);
+	s2 = s * s;
+	return e * LN2 + 2.0f * s * (1.0f + s2 * (1.0f/3 + s2 * (1.0f/5 + s2 * (1.0f/7 + s2 * (1.0f/9)))));
+}
+
+static void uniform_scalar(struct noise *n, float *dst, size_t len, float scale)
+{
+	uint32_t x[NOISE_LANES];
+	size_t k, i;
+
+	for (k = 0; k < len; k += NOISE_LANES) {
+		next8_scalar(n, x);
+		for (i = 0; i < NOISE_LANES && k + i < len; i++)
+			dst[k + i] = ((float)(x[i] >> 8) * U24 * 2.0f - 1.0f) * scale;
+	}
+}
+
+static void tpdf_scalar(struct noise *n, float *dst, size_t len, float scale)
+{
+	uint32_t a[NOISE_LANES], b[NOISE_LANES];
+	size_t k, i;
+
+	for (k = 0; k < len; k += NOISE_LANES) {
+		next8_scalar(n, a);
+		next8_scalar(n, b);
+		for (i = 0; i < NOISE_LANES && k + i < len; i++)
+			dst[k + i] = ((float)(a[i] >> 8) - (float)(b[i] >> 8)) * U24 * scale;
+	}
+}
+
+static void gauss_scalar(struct noise *n, float *dst, size_t len, float sigma)
+{
+	uint32_t a[NOISE_LANES], b[NOISE_LANES];
+	float out[2 * NOISE_LANES];
+	size_t k, i;
+
+	for (k = 0; k < len; k += 2 * NOISE_LANES) {
+		next8_scalar(n, a);
+		next8_scalar(n, b);
+		for (i = 0; i < NOISE_LANES; i++) {
+			// radius from (0, 1], angle as quadrant plus [0, pi/2) inside it
+			float r = sigma * sqrtf(-2.0f * ln_scalar((float)((a[i] >> 8) + 1) * U24));
+			float y = (float)((b[i] >> 6) & 0xffffff) * U24 * HALF_PI - QUARTER_PI;
+			float y2 = y * y;
+			float sy = y * (1.0f - y2 * (1.0f/6 - y2 * (1.0f/120 - y2 * (1.0f/5040))));
+			float cy = 1.0f - y2 * (0.5f - y2 * (1.0f/24 - y2 * (1.0f/720 - y2 * (1.0f/40320))));
+			float c = (cy - sy) * SQRT_HALF, s = (cy + sy) * SQRT_HALF, t;
+			uint32_t q = b[i] >> 30;
+
+			// rotate by q quarter turns
+			if (q & 1) {
+				t = c;
+				c = s;
+				s = t;
+			}
+			if ((q ^ (q >> 1)) & 1)
+				c = -c;
+			if (q & 2)
+				s = -s;
+			out[2*i] = r * c;
+			out[2*i + 1] = r * s;
+		}
+		for (i = 0; i < 2 * NOISE_LANES && k + i < len; i++)
+			dst[k + i] = out[i];
+	}
+}
+
+#ifdef HAVE_X86
+__attribute__((target("avx2")))
+static inline __m256i next8_avx2(struct noise *n)
+{
+	__m256i s0 = _mm256_load_si256((__m256i *)n->s[0]);
+	__m256i s1 = _mm256_load_si256((__m256i *)n->s[1]);
+	__m256i s2 = _mm256_load_si256((__m256i *)n->s[2]);
+	__m256i s3 = _mm256_load_si256((__m256i *)n->s[3]);
+	__m256i x = _mm256_add_epi32(s0, s3);
+	__m256i t = _mm256_slli_epi32(s1, 9);
+
+	s2 = _mm256_xor_si256(s2, s0);
+	s3 = _mm256_xor_si256(s3, s1);
+	s1 = _mm256_xor_si256(s1, s2);
+	s0 = _mm256_xor_si256(s0, s3);
+	s2 = _mm256_xor_si256(s2, t);
+	s3 = _mm256_or_si256(_mm256_slli_epi32(s3, 11), _mm256_srli_epi32(s3, 21));
+	_mm256_store_si256((__m256i *)n->s[0], s0);
+	_mm256_store_si256((__m256i *)n->s[1], s1);
+	_mm256_store_si256((__m256i *)n->s[2], s2);
+	_mm256_store_si256((__m256i *)n->s[3], s3);
+	return x;
+}
+
+/* top 24 bits as float, exact */
+__attribute__((target("avx2")))
+static inline __m256 top24_avx2(__m256i x)
+{
+	return _mm256_cvtepi32_ps(_mm256_srli_epi32(x, 8));
+}
+
+__attribute__((target("avx2")))
+static void uniform_avx2(struct noise *n, float *dst, size_t len, float scale)
+{
+	const __m256 u24x2 = _mm256_set1_ps(U24 * 2.0f), one = _mm256_set1_ps(1.0f);
+	const __m256 sc = _mm256_set1_ps(scale);
+	size_t k = 0;
+
+	for (; k + NOISE_LANES <= len; k += NOISE_LANES) {
+		__m256 u = _mm256_sub_ps(_mm256_mul_ps(top24_avx2(next8_avx2(n)), u24x2), one);
+
+		_mm256_storeu_ps(dst + k, _mm256_mul_ps(u, sc));
+	}
+	if (k < len)
+		uniform_scalar(n, dst + k, len - k, scale);
+}
+
+__attribute__((target("avx2")))
+static void tpdf_avx2(struct noise *n, float *dst, size_t len, float scale)
+{
+	const __m256 sc = _mm256_set1_ps(U24), s = _mm256_set1_ps(scale);
+	size_t k = 0;
+
+	for (; k + NOISE_LANES <= len; k += NOISE_LANES) {
+		__m256 a = top24_avx2(next8_avx2(n));
+		__m256 b = top24_avx2(next8_avx2(n));
+
+		_mm256_storeu_ps(dst + k, _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(a, b), sc), s));
+	}
+	if (k < len)
+		tpdf_scalar(n, dst + k, len - k, scale);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 ln_avx2(__m256 u)
+{
+	const __m256i bits = _mm256_castps_si256(u);
+	const __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23),
+		_mm256_set1_epi32(127)));
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits,
+		_mm256_set1_epi32(0x7fffff)), _mm256_set1_epi32(0x3f800000)));
+	const __m256 s = _mm256_div_ps(_mm256_sub_ps(m, one), _mm256_add_ps(m, one));
+	const __m256 s2 = _mm256_mul_ps(s, s);
+	__m256 p;
+
+	p = _mm256_add_ps(_mm256_set1_ps(1.0f/7), _mm256_mul_ps(s2, _mm256_set1_ps(1.0f/9)));
+	p = _mm256_add_ps(_mm256_set1_ps(1.0f/5), _mm256_mul_ps(s2, p));
+	p = _mm256_add_ps(_mm256_set1_ps(1.0f/3), _mm256_mul_ps(s2, p));
+	p = _mm256_add_ps(one, _mm256_mul_ps(s2, p));
+	return _mm256_add_ps(_mm256_mul_ps(e, _mm256_set1_ps(LN2)),
+		_mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(2.0f), s), p));
+}
+
+__attribute__((target("avx2")))
+static void gauss_avx2(struct noise *n, float *dst, size_t len, float sigma)
+{
+	const __m256 u24 = _mm256_set1_ps(U24), one = _mm256_set1_ps(1.0f);
+	const __m256 sign = _mm256_set1_ps(-0.0f);
+	const __m256i mask24 = _mm256_set1_epi32(0xffffff);
+	size_t k = 0;
+
+	for (; k + 2 * NOISE_LANES <= len; k += 2 * NOISE_LANES) {
+		__m256i a = next8_avx2(n), b = next8_avx2(n);
+		__m256 u = _mm256_mul_ps(_mm256_add_ps(top24_avx2(a), one), u24);
+		__m256 r = _mm256_mul_ps(_mm256_set1_ps(sigma), _mm256_sqrt_ps(
+			_mm256_mul_ps(_mm256_set1_ps(-2.0f), ln_avx2(u))));
+		__m256 y = _mm256_sub_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(
+			_mm256_and_si256(_mm256_srli_epi32(b, 6), mask24)), u24),
+			_mm256_set1_ps(HALF_PI)), _mm256_set1_ps(QUARTER_PI));
+		__m256 y2 = _mm256_mul_ps(y, y);
+		__m256 sy, cy, c, s, swap, t, lo, hi;
+		__m256i q = _mm256_srli_epi32(b, 30);
+
+		sy = _mm256_sub_ps(_mm256_set1_ps(1.0f/120), _mm256_mul_ps(y2, _mm256_set1_ps(1.0f/5040)));
+		sy = _mm256_sub_ps(_mm256_set1_ps(1.0f/6), _mm256_mul_ps(y2, sy));
+		sy = _mm256_mul_ps(y, _mm256_sub_ps(one, _mm256_mul_ps(y2, sy)));
+		cy = _mm256_sub_ps(_mm256_set1_ps(1.0f/720), _mm256_mul_ps(y2, _mm256_set1_ps(1.0f/40320)));
+		cy = _mm256_sub_ps(_mm256_set1_ps(1.0f/24), _mm256_mul_ps(y2, cy));
+		cy = _mm256_sub_ps(_mm256_set1_ps(0.5f), _mm256_mul_ps(y2, cy));
+		cy = _mm256_sub_ps(one, _mm256_mul_ps(y2, cy));
+		c = _mm256_mul_ps(_mm256_sub_ps(cy, sy), _mm256_set1_ps(SQRT_HALF));
+		s = _mm256_mul_ps(_mm256_add_ps(cy, sy), _mm256_set1_ps(SQRT_HALF));
+
+		// rotate by q quarter turns: swap on odd q, then flip signs
+		swap = _mm256_castsi256_ps(_mm256_slli_epi32(q, 31));
+		t = _mm256_blendv_ps(c, s, swap);
+		s = _mm256_blendv_ps(s, c, swap);
+		c = _mm256_xor_ps(t, _mm256_and_ps(sign, _mm256_castsi256_ps(
+			_mm256_slli_epi32(_mm256_xor_si256(q, _mm256_srli_epi32(q, 1)), 31))));
+		s = _mm256_xor_ps(s, _mm256_and_ps(sign, _mm256_castsi256_ps(
+			_mm256_slli_epi32(_mm256_srli_epi32(q, 1), 31))));
+		c = _mm256_mul_ps(r, c);
+		s = _mm256_mul_ps(r, s);
+
+		// interleave as c0 s0 c1 s1 ..., unpack works per 128 bit lane
+		lo = _mm256_unpacklo_ps(c, s);
+		hi = _mm256_unpackhi_ps(c, s);
+		_mm256_storeu_ps(dst + k, _mm256_permute2f128_ps(lo, hi, 0x20));
+		_mm256_storeu_ps(dst + k + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+	}
+	if (k < len)
+		gauss_scalar(n, dst + k, len - k, sigma);
+}
+#endif
+
+static const struct noise_kernel kernels[] = {
+#ifdef HAVE_X86
+	{ "avx2",   uniform_avx2,   tpdf_avx2,   gauss_avx2 },
+#endif
+	{ "scalar", uniform_scalar, tpdf_scalar, gauss_scalar },
+};
+
+static const struct noise_kernel *active = &kernels[sizeof(kernels)/sizeof(kernels[0]) - 1];
+
+const char *noise_init(void)
+{
+	size_t i;
+
+	// table is ordered widest first
+	for (i = 0; i < sizeof(kernels)/sizeof(kernels[0]); i++) {
+		if (simd_supported(kernels[i].name)) {
+			active = &kernels[i];
+			break;
+		}
+	}
+	return active->name;
+}
+
+bool noise_select(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(kernels)/sizeof(kernels[0]); i++) {
+		if (!strcmp(kernels[i].name, name) && simd_supported(kernels[i].name)) {
+			active = &kernels[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+const struct noise_kernel *noise_kernel(void)
+{
+	return active;
+}
+
+/* splitmix64, spreads one seed over all the state words */
+static uint64_t splitmix64(uint64_t *x)
+{
+	uint64_t z = (*x += 0x9e3779b97f4a7c15ull);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
+void noise_seed(struct noise *n, uint64_t seed)
+{
+	int j, k;
+
+	for (k = 0; k < NOISE_LANES; k++) {
+		for (j = 0; j < 4; j += 2) {
+			uint64_t z = splitmix64(&seed);
+
+			n->s[j][k] = (uint32_t)z;
+			n->s[j + 1][k] = (uint32_t)(z >> 32);
+		}
+	}
+}
+
+void noise_uniform(struct noise *n, float *dst, size_t len, float scale)
+{
+	active->uniform(n, dst, len, scale);
+}
+
+void noise_tpdf(struct noise *n, float *dst, size_t len, float scale)
+{
+	active->tpdf(n, dst, len, scale);
+}
+
+void noise_gauss(struct noise *n, float *dst, size_t len, float sigma)
+{
+	active->gauss(n, dst, len, sigma);
+}
+
+void noise_dither(struct noise *n, int16_t *x, size_t len, float scale)
+{
+	float d[DITHER_CHUNK];
+	size_t k, i;
+
+	for (k = 0; k < len; k += DITHER_CHUNK) {
+		size_t m = len - k < DITHER_CHUNK ? len - k : DITHER_CHUNK;
+
+		active->tpdf(n, d, m, scale);
+		for (i = 0; i < m; i++) {
+			long v = lrintf(x[k + i] + d[i]);
+
+			x[k + i] = v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : v;
+		}
+	}
+}
@@ -0,0 +1,62 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Noise and dither: xoshiro128+ PRNG with uniform, TPDF and Gaussian blocks
+*/
+
+#ifndef NOISE_H
+#define NOISE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define NOISE_LANES 8
+
+/*
+	 Eight independent xoshiro128+ generators, one per SIMD lane, so a
+	 block of eight values comes out of a handful of integer ops. The
+	 state is per object: no locks, no global state, one per thread. The
+	 scalar and AVX2 kernels step the lanes identically and give the same
+	 stream for the same seed.
+*/
+struct noise {
+	_Alignas(32) uint32_t s[4][NOISE_LANES];
+};
+
+/* fills len floats, scale is the peak (uniform, tpdf) or the std deviation (gauss) */
+typedef void (*noise_fn)(struct noise *n, float *dst, size_t len, float scale);
+
+struct noise_kernel {
+	const char *name;
+	noise_fn uniform;
+	noise_fn tpdf;
+	noise_fn gauss;
+};
+
+/* picks the widest kernel the CPU supports, returns its name */
+const char *noise_init(void);
+/* forces a kernel by name ("scalar", "avx2"), false if unsupported */
+bool noise_select(const char *name);
+const struct noise_kernel *noise_kernel(void);
+
+/* seeds all lanes from one 64 bit value */
+void noise_seed(struct noise *n, uint64_t seed);
+
+/* uniform in [-scale, scale) */
+void noise_uniform(struct noise *n, float *dst, size_t len, float scale);
+
+/* triangular in (-scale, scale), the difference of two uniforms: TPDF dither */
+void noise_tpdf(struct noise *n, float *dst, size_t len, float scale);
+
+/*
+	 Independent N(0, sigma^2) values by Box-Muller with polynomial log and
+	 sincos. For complex noise of power P fill 2 * nsamples interleaved
+	 values with sigma = sqrt(P / 2).
+*/
+void noise_gauss(struct noise *n, float *dst, size_t len, float sigma);
+
+/* adds TPDF dither of the given peak to int16 samples, rounding and saturating */
+void noise_dither(struct noise *n, int16_t *x, size_t len, float scale);
+
+#endif
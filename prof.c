@@ -0,0 +1,153 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Hot path timing: per stage latency histograms and event counters
+*/
+
+#include <errno.h>
+#include <string.h>
+
+#include "prof.h"
+
+bool prof_enabled;
+struct prof_stat prof_stats[PROF_NSTAGES];
+atomic_uint_fast64_t prof_counters[PROF_NCOUNTERS];
+
+static const char *const stage_names[] = {
+	[PROF_REFILL]   = "refill",
+	[PROF_TUNE]     = "tune",
+	[PROF_RECORD]   = "record",
+	[PROF_RING]     = "ring",
+	[PROF_CONVERT]  = "convert",
+	[PROF_FFT]      = "fft",
+	[PROF_DB]       = "db",
+	[PROF_OUTPUT]   = "output",
+	[PROF_FRAME]    = "frame",
+	[PROF_TX_GEN]   = "tx-gen",
+	[PROF_TX_PUSH]  = "tx-push",
+};
+
+static const char *const counter_names[] = {
+	[PROF_RX_DROPPED]    = "rx-dropped-samples",
+	[PROF_RX_GAPS]       = "rx-gaps",
+	[PROF_OVERRUNS]      = "frame-overruns",
+	[PROF_TX_UNDERFLOWS] = "tx-underflows",
+	[PROF_REC_DROPPED]   = "rec-dropped-samples",
+	[PROF_LATE_REFILLS]  = "late-refills",
+};
+
+static inline void bump(atomic_uint_fast64_t *v, uint64_t n)
+{
+	// single writer per stage, no read-modify-write needed
+	atomic_store_explicit(v, atomic_load_explicit(v, memory_order_relaxed) + n,
+		memory_order_relaxed);
+}
+
+void prof_add(enum prof_stage stage, uint64_t ns, uint64_t nsamples)
+{
+	struct prof_stat *s = &prof_stats[stage];
+	unsigned int b = ns ? 63 - __builtin_clzll(ns) : 0;
+
+	if (b >= PROF_BUCKETS)
+		b = PROF_BUCKETS - 1;
+	bump(&s->count, 1);
+	bump(&s->samples, nsamples);
+	bump(&s->total_ns, ns);
+	bump(&s->hist[b], 1);
+	if (ns > atomic_load_explicit(&s->max_ns, memory_order_relaxed))
+		atomic_store_explicit(&s->max_ns, ns, memory_order_relaxed);
+}
+
+void prof_enable(bool on)
+{
+	prof_enabled = on;
+}
+
+const char *prof_stage_name(enum prof_stage stage)
+{
+	return stage_names[stage];
+}
+
+const char *prof_counter_name(enum prof_counter c)
+{
+	return counter_names[c];
+}
+
+uint64_t prof_percentile(const struct prof_stat *s, double p)
+{
+	uint64_t n = atomic_load_explicit(&s->count, memory_order_relaxed);
+	uint64_t max = atomic_load_explicit(&s->max_ns, memory_order_relaxed);
+	uint64_t want = p * n, seen = 0;
+	unsigned int b;
+
+	if (n == 0)
+		return 0;
+	for (b = 0; b < PROF_BUCKETS - 1; b++) {
+		seen += atomic_load_explicit(&s->hist[b], memory_order_relaxed);
+		if (seen > want)
+			break;
+	}
+	// the edge can't be above the largest value seen
+	return b < PROF_BUCKETS - 1 && (2ull << b) < max ? 2ull << b : max;
+}
+
+void prof_print(FILE *fp, double elapsed)
+{
+	unsigned int i;
+
+	fprintf(fp, "  %-8s %8s %10s %10s %10s %10s %9s %7s\n", "stage", "count", "mean us",
+		"p50 us", "p99 us", "max us", "ns/smp", "busy");
+	for (i = 0; i < PROF_NSTAGES; i++) {
+		const struct prof_stat *s = &prof_stats[i];
+		uint64_t n = atomic_load(&s->count);
+		uint64_t tot = atomic_load(&s->total_ns);
+		uint64_t smp = atomic_load(&s->samples);
+
+		if (n == 0)
+			continue;
+		fprintf(fp, "  %-8s %8llu %10.1f %10.1f %10.1f %10.1f %9.3f %6.1f%%\n",
+			stage_names[i], (unsigned long long)n, tot / 1e3 / n,
+			prof_percentile(s, 0.5) / 1e3, prof_percentile(s, 0.99) / 1e3,
+			atomic_load(&s->max_ns) / 1e3, smp ? (double)tot / smp : 0,
+			elapsed > 0 ? tot / 1e7 / elapsed : 0);
+	}
+	for (i = 0; i < PROF_NCOUNTERS; i++)
+		if (atomic_load(&prof_counters[i]))
+			fprintf(fp, "  %s %llu\n", counter_names[i],
+				(unsigned long long)atomic_load(&prof_counters[i]));
+}
+
+int prof_dump(const char *path, double elapsed)
+{
+	FILE *fp = fopen(path, "w");
+	unsigned int i, b;
+
+	if (!fp)
+		return -errno;
+	fprintf(fp, "# elapsed_s %.6f\n", elapsed);
+	fprintf(fp, "# stage name count samples total_ns max_ns p50_ns p99_ns\n");
+	for (i = 0; i < PROF_NSTAGES; i++) {
+		const struct prof_stat *s = &prof_stats[i];
+
+		fprintf(fp, "stage %s %llu %llu %llu %llu %llu %llu\n", stage_names[i],
+			(unsigned long long)atomic_load(&s->count),
+			(unsigned long long)atomic_load(&s->samples),
+			(unsigned long long)atomic_load(&s->total_ns),
+			(unsigned long long)atomic_load(&s->max_ns),
+			(unsigned long long)prof_percentile(s, 0.5),
+			(unsigned long long)prof_percentile(s, 0.99));
+	}
+	fprintf(fp, "# hist name bucket_low_ns count, empty buckets left out\n");
+	for (i = 0; i < PROF_NSTAGES; i++)
+		for (b = 0; b < PROF_BUCKETS; b++)
+			if (atomic_load(&prof_stats[i].hist[b]))
+				fprintf(fp, "hist %s %llu %llu\n", stage_names[i], b ? 1ull << b : 0ull,
+					(unsigned long long)atomic_load(&prof_stats[i].hist[b]));
+	fprintf(fp, "# counter name value\n");
+	for (i = 0; i < PROF_NCOUNTERS; i++)
+		fprintf(fp, "counter %s %llu\n", counter_names[i],
+			(unsigned long long)atomic_load(&prof_counters[i]));
+	if (fclose(fp))
+		return -errno;
+	return 0;
+}
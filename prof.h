@@ -0,0 +1,104 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Hot path timing: per stage latency histograms and event counters
+*/
+
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define PROF_BUCKETS 40   // bucket b holds [2^b, 2^(b+1)) ns, the last one everything above
+
+enum prof_stage {
+	PROF_REFILL,      // source read: radio refill, file replay, synth or loopback
+	PROF_TUNE,        // LO retune between sweep steps
+	PROF_RECORD,      // copy into the recorder
+	PROF_RING,        // copy into the capture ring
+	PROF_CONVERT,     // raw I/Q to FFT input
+	PROF_FFT,         // windowing, FFT and power accumulation of completed segments
+	PROF_DB,          // average, dB and fftshift
+	PROF_OUTPUT,      // spectrum frame write
+	PROF_FRAME,       // DSP loop iteration, wait excluded
+	PROF_TX_GEN,      // TX block generation
+	PROF_TX_PUSH,     // TX block copy and push
+	PROF_NSTAGES
+};
+
+enum prof_counter {
+	PROF_RX_DROPPED,  // samples lost because the capture ring was full
+	PROF_RX_GAPS,     // blocks the DSP loop found missing
+	PROF_OVERRUNS,    // frames that took longer than their samples last
+	PROF_TX_UNDERFLOWS,
+	PROF_REC_DROPPED, // samples the recorder could not keep
+	PROF_LATE_REFILLS,// source reads that came well after the previous one
+	PROF_NCOUNTERS
+};
+
+/*
+	 Every stage is only ever timed from one thread, so its accumulators
+	 have a single writer and are updated with plain relaxed loads and
+	 stores, no locked instructions and no sharing of cache lines with
+	 other stages. Readers (the summary) may see a stage mid update, which
+	 only matters to the last sample. Timing is clock_gettime() around
+	 whole blocks, tens of ns against ms of work per block. Disabled, the
+	 macros cost one predictable branch.
+*/
+struct prof_stat {
+	_Alignas(64) atomic_uint_fast64_t count;
+	atomic_uint_fast64_t samples;
+	atomic_uint_fast64_t total_ns;
+	atomic_uint_fast64_t max_ns;
+	atomic_uint_fast64_t hist[PROF_BUCKETS];
+};
+
+extern bool prof_enabled;
+extern struct prof_stat prof_stats[PROF_NSTAGES];
+extern atomic_uint_fast64_t prof_counters[PROF_NCOUNTERS];
+
+static inline uint64_t prof_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* adds one timing of ns covering nsamples samples to a stage */
+void prof_add(enum prof_stage stage, uint64_t ns, uint64_t nsamples);
+
+#define PROF_START(t) uint64_t t = prof_enabled ? prof_now() : 0
+#define PROF_END(stage, t, nsamples) do { \
+	if (prof_enabled) \
+		prof_add(stage, prof_now() - (t), nsamples); \
+} while (0)
+
+/* counters may be bumped from any thread */
+static inline void prof_count(enum prof_counter c, uint64_t n)
+{
+	if (prof_enabled)
+		atomic_fetch_add_explicit(&prof_counters[c], n, memory_order_relaxed);
+}
+
+void prof_enable(bool on);
+const char *prof_stage_name(enum prof_stage stage);
+const char *prof_counter_name(enum prof_counter c);
+
+/* approximate percentile from the histogram: upper edge of its bucket, at most the max, ns */
+uint64_t prof_percentile(const struct prof_stat *s, double p);
+
+/* human readable table of the stages that ran, elapsed is the wall time they shared */
+void prof_print(FILE *fp, double elapsed);
+
+/*
+	 Machine readable dump, one "stage", "hist" or "counter" record per
+	 line, whitespace separated, # comments. Negative errno on failure.
+*/
+int prof_dump(const char *path, double elapsed);
+
+#endif
@@ -0,0 +1,258 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Raw I/Q recorder: double buffered, written to disk by its own thread
+*/
+
+#define _GNU_SOURCE   // O_DIRECT
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "recorder.h"
+
+static uint64_t realtime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while (len) {
+		ssize_t n = write(fd, p, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* key = value text next to the data, rewritten on close with the totals */
+static int write_meta(const struct recorder *rec, bool complete)
+{
+	const char *name = strrchr(rec->path, '/');
+	char path[sizeof(rec->path) + 8];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s.meta", rec->path);
+	fp = fopen(path, "w");
+	if (!fp)
+		return -errno;
+	fprintf(fp, "# spectrum raw I/Q recording\n");
+	fprintf(fp, "data = %s\n", name ? name + 1 : rec->path);
+	fprintf(fp, "layout = int16 interleaved I Q, host byte order container\n");
+	fprintf(fp, "format = %s\n", rec->meta.format);
+	fprintf(fp, "sample_rate = %.0f\n", rec->meta.fs_hz);
+	fprintf(fp, "lo_frequency = %.0f\n", rec->meta.lo_hz);
+	fprintf(fp, "bandwidth = %.0f\n", rec->meta.bw_hz);
+	fprintf(fp, "start_ns = %llu\n", (unsigned long long) rec->start_ns);
+	fprintf(fp, "samples = %llu\n", (unsigned long long) atomic_load(&rec->samples));
+	fprintf(fp, "dropped = %llu\n", (unsigned long long) atomic_load(&rec->dropped));
+	fprintf(fp, "complete = %s\n", complete ? "yes" : "no");
+	return fclose(fp) ? -errno : 0;
+}
+
+static void *writer_thread(void *arg)
+{
+	struct recorder *rec = arg;
+
+	pthread_mutex_lock(&rec->lock);
+	for (;;) {
+		void *buf;
+		size_t len;
+		int ret;
+
+		while (!rec->pending && !rec->closing)
+			pthread_cond_wait(&rec->cond, &rec->lock);
+		if (!rec->pending)
+			break;
+		buf = rec->pending;
+		len = rec->pending_len;
+		pthread_mutex_unlock(&rec->lock);
+
+		// after an error keep draining so the capture side never stalls
+		ret = rec->error ? rec->error : write_all(rec->fd, buf, len);
+		if (ret < 0)
+			atomic_fetch_add(&rec->dropped, len / 4);
+		else
+			atomic_fetch_add(&rec->samples, len / 4);
+
+		pthread_mutex_lock(&rec->lock);
+		if (ret < 0 && !rec->error)
+			rec->error = ret;
+		rec->pending = NULL;
+		pthread_cond_broadcast(&rec->cond);
+	}
+	pthread_mutex_unlock(&rec->lock);
+	return NULL;
+}
+
+int recorder_open(struct recorder *rec, const char *path, size_t chunk, bool direct,
+		const struct recorder_meta *meta)
+{
+	int ret, i;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->fd = -1;
+	if (strlen(path) >= sizeof(rec->path) || chunk == 0)
+		return -EINVAL;
+	snprintf(rec->path, sizeof(rec->path), "%s", path);
+	rec->meta = *meta;
+	rec->chunk = (chunk + RECORDER_ALIGN - 1) / RECORDER_ALIGN * RECORDER_ALIGN;
+
+	for (i = 0; i < 2; i++) {
+		if (posix_memalign(&rec->buf[i], RECORDER_ALIGN, rec->chunk)) {
+			ret = -ENOMEM;
+			goto fail;
+		}
+		// fault the pages in now, not in the capture thread
+		memset(rec->buf[i], 0, rec->chunk);
+	}
+
+	if (direct) {
+		rec->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+		rec->direct = rec->fd >= 0;
+	}
+	if (rec->fd < 0)
+		rec->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (rec->fd < 0) {
+		ret = -errno;
+		goto fail;
+	}
+
+	rec->start_ns = realtime_ns();
+	atomic_init(&rec->samples, 0);
+	atomic_init(&rec->dropped, 0);
+	ret = write_meta(rec, false);
+	if (ret < 0)
+		goto fail;
+
+	pthread_mutex_init(&rec->lock, NULL);
+	pthread_cond_init(&rec->cond, NULL);
+	ret = -pthread_create(&rec->thread, NULL, writer_thread, rec);
+	if (ret < 0) {
+		pthread_cond_destroy(&rec->cond);
+		pthread_mutex_destroy(&rec->lock);
+		goto fail;
+	}
+	return 0;
+
+fail:
+	if (rec->fd >= 0)
+		close(rec->fd);
+	free(rec->buf[0]);
+	free(rec->buf[1]);
+	memset(rec, 0, sizeof(*rec));
+	rec->fd = -1;
+	return ret;
+}
+
+/* hands buf[cur] to the writer and switches buffers, drops it if the writer is busy */
+static void hand_off(struct recorder *rec)
+{
+	pthread_mutex_lock(&rec->lock);
+	if (rec->pending) {
+		atomic_fetch_add(&rec->dropped, rec->fill / 4);
+	} else {
+		rec->pending = rec->buf[rec->cur];
+		rec->pending_len = rec->fill;
+		rec->cur ^= 1;
+		pthread_cond_signal(&rec->cond);
+	}
+	pthread_mutex_unlock(&rec->lock);
+	rec->fill = 0;
+}
+
+void recorder_write(struct recorder *rec, const void *src, size_t nsamples,
+		ptrdiff_t step, ptrdiff_t q_offset)
+{
+	const char *s = src;
+
+	while (nsamples) {
+		size_t room = (rec->chunk - rec->fill) / 4;
+		size_t n = nsamples < room ? nsamples : room;
+		int16_t *d = (int16_t *)((char *)rec->buf[rec->cur] + rec->fill);
+		size_t k;
+
+		if (step == 4 && q_offset == 2) {
+			// only I and Q enabled, the buffer is already what goes to disk
+			memcpy(d, s, n * 4);
+		} else {
+			for (k = 0; k < n; k++) {
+				d[2*k]     = *(const int16_t *)(s + k*step);
+				d[2*k + 1] = *(const int16_t *)(s + k*step + q_offset);
+			}
+		}
+		s += n * step;
+		nsamples -= n;
+		rec->fill += n * 4;
+		if (rec->fill == rec->chunk)
+			hand_off(rec);
+	}
+}
+
+int recorder_close(struct recorder *rec)
+{
+	size_t aligned, tail;
+	char *last;
+	int ret;
+
+	if (rec->fd < 0)
+		return 0;
+
+	// wait for the writer to finish the buffer it holds, then stop it
+	pthread_mutex_lock(&rec->lock);
+	while (rec->pending)
+		pthread_cond_wait(&rec->cond, &rec->lock);
+	rec->closing = true;
+	pthread_cond_broadcast(&rec->cond);
+	pthread_mutex_unlock(&rec->lock);
+	pthread_join(rec->thread, NULL);
+
+	// last partial buffer, O_DIRECT only takes whole aligned blocks
+	ret = rec->error;
+	last = rec->buf[rec->cur];
+	aligned = rec->direct ? rec->fill / RECORDER_ALIGN * RECORDER_ALIGN : rec->fill;
+	tail = rec->fill - aligned;
+	if (!ret && aligned)
+		ret = write_all(rec->fd, last, aligned);
+	if (!ret && tail) {
+		if (fcntl(rec->fd, F_SETFL, fcntl(rec->fd, F_GETFL) & ~O_DIRECT) < 0)
+			ret = -errno;
+		else
+			ret = write_all(rec->fd, last + aligned, tail);
+	}
+	if (ret < 0)
+		atomic_fetch_add(&rec->dropped, rec->fill / 4);
+	else
+		atomic_fetch_add(&rec->samples, rec->fill / 4);
+	if (close(rec->fd) < 0 && !ret)
+		ret = -errno;
+	rec->fd = -1;
+	rec->error = ret;
+
+	if (write_meta(rec, ret == 0) < 0 && !ret)
+		ret = -EIO;
+
+	pthread_cond_destroy(&rec->cond);
+	pthread_mutex_destroy(&rec->lock);
+	free(rec->buf[0]);
+	free(rec->buf[1]);
+	rec->buf[0] = rec->buf[1] = NULL;
+	return ret;
+}
@@ -0,0 +1,76 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Raw I/Q recorder: double buffered, written to disk by its own thread
+*/
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define RECORDER_ALIGN 4096   // buffer, size and offset alignment for O_DIRECT
+
+/* what the sidecar metadata file describes */
+struct recorder_meta {
+	double fs_hz;
+	double lo_hz;
+	double bw_hz;
+	char format[32];          // IIO format of the 16 bit words, e.g. "le:S12/16>>0"
+};
+
+/*
+	 The capture thread copies interleaved int16 I/Q into the fill buffer.
+	 A full buffer is handed to the writer thread and the other one becomes
+	 the fill buffer, so the capture thread never waits on the disk. If the
+	 writer still holds the other buffer the data is dropped and counted,
+	 the capture cadence matters more than a complete recording.
+*/
+struct recorder {
+	int fd;
+	bool direct;              // file opened with O_DIRECT
+	char path[256];
+	struct recorder_meta meta;
+	uint64_t start_ns;
+
+	void *buf[2];
+	size_t chunk;             // bytes per buffer, multiple of RECORDER_ALIGN
+	size_t fill;              // bytes in buf[cur]
+	unsigned int cur;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	void *pending;            // buffer handed to the writer, NULL when idle
+	size_t pending_len;
+	bool closing;
+	int error;                // first write error, negative errno
+
+	atomic_uint_fast64_t samples;   // samples written to disk
+	atomic_uint_fast64_t dropped;   // samples lost because the writer was busy
+};
+
+/*
+	 Creates path and path.meta and starts the writer. chunk is rounded up
+	 to RECORDER_ALIGN, direct asks for O_DIRECT and falls back to buffered
+	 writes where the file system refuses it.
+*/
+int recorder_open(struct recorder *rec, const char *path, size_t chunk, bool direct,
+		const struct recorder_meta *meta);
+
+/*
+	 Appends nsamples I/Q pairs, src points to the I value of the first
+	 sample, the Q value follows at q_offset bytes and samples are step
+	 bytes apart. Called from one thread only.
+*/
+void recorder_write(struct recorder *rec, const void *src, size_t nsamples,
+		ptrdiff_t step, ptrdiff_t q_offset);
+
+/* flushes the last partial buffer, stops the writer and finalises the metadata */
+int recorder_close(struct recorder *rec);
+
+#endif
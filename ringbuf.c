@@ -0,0 +1,143 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Single-producer/single-consumer ring of preallocated sample blocks
+*/
+
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ringbuf.h"
+
+int ringbuf_init(struct ringbuf *rb, unsigned int count, size_t block_size)
+{
+	unsigned int i;
+
+	// count must be a power of two so the slot index is a mask
+	if (count == 0 || (count & (count - 1)))
+		return -EINVAL;
+
+	memset(rb, 0, sizeof(*rb));
+	rb->blocks = calloc(count, sizeof(*rb->blocks));
+	if (!rb->blocks)
+		return -ENOMEM;
+	rb->count = count;
+	rb->block_size = block_size;
+
+	// allocate everything up front, nothing is allocated while streaming
+	for (i = 0; i < count; i++) {
+		if (posix_memalign(&rb->blocks[i].data, 64, block_size)) {
+			ringbuf_free(rb);
+			return -ENOMEM;
+		}
+		// touch the pages now rather than on the first capture
+		memset(rb->blocks[i].data, 0, block_size);
+	}
+
+	atomic_init(&rb->head, 0);
+	atomic_init(&rb->tail, 0);
+	atomic_init(&rb->produced, 0);
+	atomic_init(&rb->dropped, 0);
+	atomic_init(&rb->dropped_samples, 0);
+	atomic_init(&rb->high_water, 0);
+	return 0;
+}
+
+void ringbuf_free(struct ringbuf *rb)
+{
+	unsigned int i;
+
+	if (rb->blocks) {
+		for (i = 0; i < rb->count; i++)
+			free(rb->blocks[i].data);
+		free(rb->blocks);
+	}
+	rb->blocks = NULL;
+	rb->count = 0;
+}
+
+struct sample_block *ringbuf_acquire(struct ringbuf *rb)
+{
+	uint_fast64_t head = atomic_load_explicit(&rb->head, memory_order_relaxed);
+	uint_fast64_t tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
+
+	if (head - tail >= rb->count)
+		return NULL;
+	return &rb->blocks[head & (rb->count - 1)];
+}
+
+void ringbuf_publish(struct ringbuf *rb)
+{
+	uint_fast64_t head = atomic_load_explicit(&rb->head, memory_order_relaxed) + 1;
+	uint_fast64_t tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+
+	atomic_store_explicit(&rb->head, head, memory_order_release);
+	atomic_fetch_add_explicit(&rb->produced, 1, memory_order_relaxed);
+	if (head - tail > atomic_load_explicit(&rb->high_water, memory_order_relaxed))
+		atomic_store_explicit(&rb->high_water, head - tail, memory_order_relaxed);
+}
+
+void ringbuf_drop(struct ringbuf *rb, size_t nsamples)
+{
+	atomic_fetch_add_explicit(&rb->dropped, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&rb->dropped_samples, nsamples, memory_order_relaxed);
+}
+
+struct sample_block *ringbuf_peek(struct ringbuf *rb)
+{
+	uint_fast64_t tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+	uint_fast64_t head = atomic_load_explicit(&rb->head, memory_order_acquire);
+
+	if (head == tail)
+		return NULL;
+	return &rb->blocks[tail & (rb->count - 1)];
+}
+
+void ringbuf_release(struct ringbuf *rb)
+{
+	uint_fast64_t tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+
+	atomic_store_explicit(&rb->tail, tail + 1, memory_order_release);
+}
+
+unsigned int ringbuf_fill(struct ringbuf *rb)
+{
+	uint_fast64_t tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
+	uint_fast64_t head = atomic_load_explicit(&rb->head, memory_order_acquire);
+
+	return (unsigned int)(head - tail);
+}
+
+struct sample_block *ringbuf_wait(struct ringbuf *rb, volatile bool *stop)
+{
+	struct sample_block *blk;
+	struct timespec nap = { 0, 100000 }; // 100 us
+	unsigned int spins = 0;
+
+	while (!(blk = ringbuf_peek(rb)) && !*stop) {
+		// spin briefly, then back off so an idle consumer doesn't burn a core
+		if (++spins < 64)
+			sched_yield();
+		else
+			nanosleep(&nap, NULL);
+	}
+	return blk;
+}
+
+struct sample_block *ringbuf_wait_free(struct ringbuf *rb, volatile bool *stop)
+{
+	struct sample_block *blk;
+	struct timespec nap = { 0, 100000 }; // 100 us
+	unsigned int spins = 0;
+
+	while (!(blk = ringbuf_acquire(rb)) && !*stop) {
+		if (++spins < 64)
+			sched_yield();
+		else
+			nanosleep(&nap, NULL);
+	}
+	return blk;
+}
@@ -0,0 +1,66 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Single-producer/single-consumer ring of preallocated sample blocks
+*/
+
+#ifndef RINGBUF_H
+#define RINGBUF_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* one captured buffer worth of raw interleaved samples */
+struct sample_block {
+	void *data;        // raw sample bytes, block_size long
+	size_t len;        // number of valid bytes in data
+	size_t nsamples;   // number of samples (len / step)
+	ptrdiff_t step;    // bytes between two samples of the same channel
+	ptrdiff_t first;   // byte offset of the first sample of channel 0
+	uint64_t seq;      // capture sequence number, gaps mean lost buffers
+	unsigned int lo_index;  // sweep step the block was taken at, 0 when not sweeping
+};
+
+/*
+	 Lock-free SPSC ring. The producer (capture thread) only writes head,
+	 the consumer (DSP thread) only writes tail. Both are free running
+	 counters, the slot index is counter & (count - 1).
+*/
+struct ringbuf {
+	struct sample_block *blocks;
+	unsigned int count;      // number of blocks, power of two
+	size_t block_size;       // bytes per block
+
+	_Alignas(64) atomic_uint_fast64_t head;
+	_Alignas(64) atomic_uint_fast64_t tail;
+
+	// capture statistics, written by the producer only
+	_Alignas(64) atomic_uint_fast64_t produced;  // blocks published
+	atomic_uint_fast64_t dropped;                // blocks lost because ring was full
+	atomic_uint_fast64_t dropped_samples;        // samples lost because ring was full
+	atomic_uint_fast64_t high_water;             // max blocks queued at once
+};
+
+int ringbuf_init(struct ringbuf *rb, unsigned int count, size_t block_size);
+void ringbuf_free(struct ringbuf *rb);
+
+/* producer side: get a free block (NULL when full) and publish it */
+struct sample_block *ringbuf_acquire(struct ringbuf *rb);
+void ringbuf_publish(struct ringbuf *rb);
+void ringbuf_drop(struct ringbuf *rb, size_t nsamples);
+
+/* consumer side: look at the oldest block (NULL when empty) and release it */
+struct sample_block *ringbuf_peek(struct ringbuf *rb);
+void ringbuf_release(struct ringbuf *rb);
+
+/* blocks currently queued */
+unsigned int ringbuf_fill(struct ringbuf *rb);
+
+/* consumer side: wait for a block until one arrives or *stop is set */
+struct sample_block *ringbuf_wait(struct ringbuf *rb, volatile bool *stop);
+/* producer side: wait for a free block until one is released or *stop is set */
+struct sample_block *ringbuf_wait_free(struct ringbuf *rb, volatile bool *stop);
+
+#endif
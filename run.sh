@@ -1,4 +1,5 @@
 #!/bin/bash
-make ad9361-iiostream-spectrum 
+make ad9361-iiostream-spectrum spec-dump
 ./ad9361-iiostream-spectrum
+./spec-dump -a spectrum.spec
 ./tables.sh
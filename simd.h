@@ -0,0 +1,35 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Runtime CPU feature checks for the SIMD kernels
+*/
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+/*
+	 Kernels are compiled with __attribute__((target(...))) so the build
+	 needs no -m flags, this decides at runtime which of them may run.
+	 Names are the ones used in the kernel tables: "avx2", "sse2", "scalar".
+*/
+static inline bool simd_supported(const char *name)
+{
+#ifdef HAVE_X86
+	__builtin_cpu_init();
+	if (!strcmp(name, "avx2"))
+		return __builtin_cpu_supports("avx2");
+	if (!strcmp(name, "sse2"))
+		return __builtin_cpu_supports("sse2");
+#endif
+	return !strcmp(name, "scalar");
+}
+
+#endif
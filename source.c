@@ -0,0 +1,564 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Sample sources: IIO radio, file replay or synthetic signal behind one interface
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "source.h"
+
+#define PACE_SLICE_NS 10000000   // longest sleep between cancel checks, 10 ms
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* iio: a refill per read, exactly what the capture loop used to do */
+static int iio_read(struct source *src, struct source_block *blk)
+{
+	ssize_t nbytes = iio_buffer_refill(src->buf);
+
+	if (nbytes < 0)
+		return nbytes;
+	blk->data = iio_buffer_start(src->buf);
+	blk->len = nbytes;
+	blk->step = iio_buffer_step(src->buf);
+	blk->first = (const char *)iio_buffer_first(src->buf, src->chn_i) - (const char *)blk->data;
+	blk->nsamples = nbytes / blk->step;
+	return blk->nsamples;
+}
+
+static void iio_cancel(struct source *src)
+{
+	iio_buffer_cancel(src->buf);
+}
+
+static void iio_close(struct source *src)
+{
+	// the buffer belongs to whoever created it
+	src->buf = NULL;
+}
+
+/* the blocks the kernel already filled, or is filling, were taken at the old LO */
+static int iio_tune(struct source *src, double lo_hz)
+{
+	int ret;
+
+	if (!src->lo_chn)
+		return -EOPNOTSUPP;
+	// a stored profile is one register write, a new frequency a full calibration
+	ret = src->fastlock ? fastlock_tune(src->fastlock, lo_hz) : -ENOENT;
+	if (ret == -ENOENT)
+		ret = iio_channel_attr_write_longlong(src->lo_chn, "frequency", llround(lo_hz));
+	if (ret < 0)
+		return ret;
+	src->lo_hz = lo_hz;
+	return src->kernel_buffers * src->block;
+}
+
+static const struct source_ops iio_ops = { "iio", iio_read, iio_cancel, iio_close, iio_tune };
+
+int source_open_iio(struct source *src, struct iio_buffer *buf, const struct iio_channel *chn_i,
+		const struct iio_channel *chn_q, struct iio_channel *lo_chn, size_t block,
+		double fs, double lo, double bw)
+{
+	memset(src, 0, sizeof(*src));
+	src->ops = &iio_ops;
+	src->buf = buf;
+	src->chn_i = chn_i;
+	src->lo_chn = lo_chn;
+	src->kernel_buffers = SOURCE_KERNEL_BUFFERS;
+	src->block = block;
+	src->fs_hz = fs;
+	src->lo_hz = lo;
+	src->bw_hz = bw;
+	src->sample_size = iio_buffer_step(buf);
+	convert_layout_init(&src->layout, chn_i, chn_q, buf);
+	snprintf(src->desc, sizeof(src->desc), "iio");
+	return 0;
+}
+
+bool source_is_iio(const char *spec)
+{
+	static const char *const prefixes[] = { "iio:", "ip:", "usb:", "local:", "serial:", "xml:" };
+	size_t i;
+
+	for (i = 0; i < sizeof(prefixes)/sizeof(prefixes[0]); i++)
+		if (!strncmp(spec, prefixes[i], strlen(prefixes[i])))
+			return true;
+	return false;
+}
+
+/* files: hand out the next run of the mapped or parsed samples */
+static int file_read(struct source *src, struct source_block *blk)
+{
+	size_t n;
+
+	if (src->pos == src->total) {
+		if (!src->loop || !src->total)
+			return 0;
+		src->pos = 0;
+		src->wraps++;
+	}
+	n = src->total - src->pos < src->block ? src->total - src->pos : src->block;
+	blk->data = src->iq + 2 * src->pos;
+	blk->len = n * src->sample_size;
+	blk->nsamples = n;
+	blk->step = src->sample_size;
+	blk->first = 0;
+	src->pos += n;
+	return n;
+}
+
+static void file_cancel(struct source *src)
+{
+	(void)src;
+}
+
+static void file_close(struct source *src)
+{
+	if (src->map)
+		munmap(src->map, src->map_len);
+	else
+		free(src->iq);
+	src->map = NULL;
+	src->iq = NULL;
+}
+
+static const struct source_ops raw_ops = { "raw", file_read, file_cancel, file_close };
+static const struct source_ops text_ops = { "text", file_read, file_cancel, file_close };
+
+static int map_file(const char *path, void **map, size_t *len)
+{
+	struct stat st;
+	int fd, ret = 0;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	if (fstat(fd, &st) < 0) {
+		ret = -errno;
+	} else if (st.st_size == 0) {
+		ret = -ENODATA;
+	} else {
+		*len = st.st_size;
+		*map = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (*map == MAP_FAILED)
+			ret = -errno;
+		else
+			madvise(*map, *len, MADV_SEQUENTIAL);
+	}
+	close(fd);
+	return ret;
+}
+
+/* fills fs and lo from the recorder's FILE.meta, if there is one */
+static void read_meta(struct source *src, const char *path)
+{
+	char name[512], line[256];
+	double v;
+	FILE *fp;
+
+	snprintf(name, sizeof(name), "%s.meta", path);
+	fp = fopen(name, "r");
+	if (!fp)
+		return;
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "sample_rate = %lf", &v) == 1)
+			src->fs_hz = v;
+		else if (sscanf(line, "lo_frequency = %lf", &v) == 1)
+			src->lo_hz = v;
+		else if (sscanf(line, "bandwidth = %lf", &v) == 1)
+			src->bw_hz = v;
+	}
+	fclose(fp);
+}
+
+static int open_raw(struct source *src, const char *path)
+{
+	int ret = map_file(path, &src->map, &src->map_len);
+
+	if (ret < 0)
+		return ret;
+	src->ops = &raw_ops;
+	src->iq = src->map;
+	src->total = src->map_len / (2 * sizeof(int16_t));
+	read_meta(src, path);
+	return 0;
+}
+
+/* one number, int or float with optional exponent, NULL if p isn't at one */
+static const char *parse_num(const char *p, const char *end, double *v)
+{
+	double x = 0, frac = 0.1;
+	bool neg = false, digits = false;
+	int e = 0, esign = 1;
+
+	if (p < end && (*p == '-' || *p == '+'))
+		neg = *p++ == '-';
+	for (; p < end && *p >= '0' && *p <= '9'; p++, digits = true)
+		x = x * 10 + (*p - '0');
+	if (p < end && *p == '.')
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits = true, frac *= 0.1)
+			x += (*p - '0') * frac;
+	if (!digits)
+		return NULL;
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		if (p < end && (*p == '-' || *p == '+'))
+			esign = *p++ == '-' ? -1 : 1;
+		for (; p < end && *p >= '0' && *p <= '9'; p++)
+			e = e * 10 + (*p - '0');
+		x *= pow(10, esign * e);
+	}
+	*v = neg ? -x : x;
+	return p;
+}
+
+/*
+	 Parses the whole file once at open, replay is then the same as raw.
+	 The last two numbers of a line are I and Q, so "I,Q", "I, Q, " and
+	 "index I Q" all work. Lines without two numbers (headers) are skipped.
+	 Values all within +-1.5 are taken as normalised and scaled to codes.
+*/
+static int open_text(struct source *src, const char *path)
+{
+	const char *p, *end, *eol;
+	size_t lines = 1, n = 0, k;
+	float *vals;
+	double peak = 0, scale = 1;
+	void *map;
+	size_t len;
+	int ret;
+
+	ret = map_file(path, &map, &len);
+	if (ret < 0)
+		return ret;
+	p = map;
+	end = p + len;
+	for (eol = p; (eol = memchr(eol, '\n', end - eol)); eol++)
+		lines++;
+
+	vals = malloc(sizeof(float) * 2 * lines);
+	if (!vals) {
+		munmap(map, len);
+		return -ENOMEM;
+	}
+
+	for (; p < end; p = eol + 1) {
+		double v[2] = { 0, 0 }, x;
+		const char *q = p;
+		int nv = 0;
+
+		eol = memchr(p, '\n', end - p);
+		if (!eol)
+			eol = end;
+		while (q < eol) {
+			while (q < eol && (*q == ' ' || *q == '\t' || *q == ',' || *q == '\r' || *q == ';'))
+				q++;
+			if (q == eol)
+				break;
+			q = parse_num(q, eol, &x);
+			if (!q) {
+				nv = 0;
+				break;
+			}
+			// keep the last two
+			v[0] = v[1];
+			v[1] = x;
+			nv++;
+		}
+		if (nv < 2)
+			continue;
+		vals[2*n] = v[0];
+		vals[2*n + 1] = v[1];
+		if (fabs(v[0]) > peak)
+			peak = fabs(v[0]);
+		if (fabs(v[1]) > peak)
+			peak = fabs(v[1]);
+		n++;
+	}
+	munmap(map, len);
+
+	if (n == 0) {
+		free(vals);
+		return -ENODATA;
+	}
+	if (peak <= 1.5)
+		scale = SOURCE_FULL_SCALE;
+
+	// int16 in place, the float array is at least as large
+	src->iq = (int16_t *)vals;
+	for (k = 0; k < 2 * n; k++) {
+		long x = lrint(vals[k] * scale);
+
+		src->iq[k] = x > INT16_MAX ? INT16_MAX : x < INT16_MIN ? INT16_MIN : x;
+	}
+	src->total = n;
+	src->ops = &text_ops;
+	return 0;
+}
+
+/* raw int16 unless the start of the file is all printable text */
+static bool looks_like_text(const char *path)
+{
+	unsigned char head[256];
+	size_t n, i;
+	FILE *fp = fopen(path, "rb");
+
+	if (!fp)
+		return false;
+	n = fread(head, 1, sizeof(head), fp);
+	fclose(fp);
+	for (i = 0; i < n; i++)
+		if (head[i] < 0x20 && head[i] != '\n' && head[i] != '\r' && head[i] != '\t')
+			return false;
+		else if (head[i] > 0x7e)
+			return false;
+	return n > 0;
+}
+
+/* synthetic: one NCO tone plus Gaussian noise, generated per read */
+static int synth_read(struct source *src, struct source_block *blk)
+{
+	size_t k, n = src->block;
+
+	nco_generate(&src->nco, src->scratch, n);
+	noise_gauss(&src->noise, src->nbuf, 2 * n, src->sigma);
+	for (k = 0; k < 2 * n; k++) {
+		long x = lrintf(src->scratch[k] + src->nbuf[k]);
+
+		src->scratch[k] = x > INT16_MAX ? INT16_MAX : x < INT16_MIN ? INT16_MIN : x;
+	}
+	blk->data = src->scratch;
+	blk->len = n * src->sample_size;
+	blk->nsamples = n;
+	blk->step = src->sample_size;
+	blk->first = 0;
+	return n;
+}
+
+static void synth_close(struct source *src)
+{
+	free(src->scratch);
+	free(src->nbuf);
+	src->scratch = NULL;
+	src->nbuf = NULL;
+}
+
+/* the tone stays at its RF frequency, outside the band it is gone, not aliased */
+static int synth_tune(struct source *src, double lo_hz)
+{
+	double f = src->tone_hz - lo_hz;
+
+	src->nco.tone[0].step = nco_step(src->fs_hz, f);
+	src->nco.tone[0].ampl = fabs(f) < src->fs_hz / 2 ? SOURCE_FULL_SCALE / 2 : 0;
+	src->lo_hz = lo_hz;
+	return 0;
+}
+
+static const struct source_ops synth_ops = { "synth", synth_read, file_cancel, synth_close,
+	synth_tune };
+
+static int open_synth(struct source *src, const char *args)
+{
+	double freq = 1e6, noise_dbfs = -60;
+
+	if (args && *args)
+		sscanf(args, "%lf,%lf", &freq, &noise_dbfs);
+	src->scratch = malloc(sizeof(int16_t) * 2 * src->block);
+	src->nbuf = malloc(sizeof(float) * 2 * src->block);
+	if (!src->scratch || !src->nbuf) {
+		synth_close(src);
+		return -ENOMEM;
+	}
+	nco_reset(&src->nco, src->fs_hz);
+	nco_add_tone(&src->nco, freq, SOURCE_FULL_SCALE / 2);
+	src->tone_hz = freq;
+	noise_seed(&src->noise, 1);
+	// noise power relative to a full scale tone, split over I and Q
+	src->sigma = SOURCE_FULL_SCALE * pow(10, noise_dbfs / 20) / sqrt(2);
+	src->ops = &synth_ops;
+	// outside the band the tone only shows up once swept to
+	snprintf(src->desc, sizeof(src->desc), "synth %.0f Hz tone, %.1f dBFS noise",
+		fabs(freq) < src->fs_hz / 2 ? nco_freq(&src->nco, 0) : freq, noise_dbfs);
+	return 0;
+}
+
+/* loopback: the TX ring through the channel emulator */
+static int loop_read(struct source *src, struct source_block *blk)
+{
+	struct sample_block *tb = ringbuf_wait(src->tx, &src->cancelled);
+	size_t n;
+
+	if (!tb)
+		return -ECANCELED;
+	n = tb->nsamples < src->block ? tb->nsamples : src->block;
+	channel_run(&src->chan, (const int16_t *)((const char *)tb->data + tb->first),
+		src->scratch, n);
+	ringbuf_release(src->tx);
+
+	blk->data = src->scratch;
+	blk->len = n * src->sample_size;
+	blk->nsamples = n;
+	blk->step = src->sample_size;
+	blk->first = 0;
+	return n;
+}
+
+static void loop_close(struct source *src)
+{
+	channel_free(&src->chan);
+	free(src->scratch);
+	src->scratch = NULL;
+}
+
+static const struct source_ops loop_ops = { "loop", loop_read, file_cancel, loop_close };
+
+bool source_is_loopback(const char *spec)
+{
+	return !strncmp(spec, "loop", 4) && (spec[4] == '\0' || spec[4] == ':');
+}
+
+int source_open_loopback(struct source *src, struct ringbuf *tx, const char *spec,
+		size_t block, double fs, bool paced)
+{
+	struct channel_cfg cfg;
+	char str[160];
+	int ret;
+
+	memset(src, 0, sizeof(*src));
+	if (!source_is_loopback(spec) || block == 0 || fs <= 0)
+		return -EINVAL;
+	channel_cfg_default(&cfg);
+	ret = channel_cfg_parse(&cfg, spec[4] ? spec + 5 : NULL);
+	if (ret < 0)
+		return ret;
+	src->block = block;
+	src->fs_hz = fs;
+	src->paced = paced;
+	src->sample_size = 2 * sizeof(int16_t);
+	src->tx = tx;
+	convert_layout_native(&src->layout);
+
+	src->scratch = malloc(sizeof(int16_t) * 2 * block);
+	if (!src->scratch)
+		return -ENOMEM;
+	ret = channel_init(&src->chan, &cfg, fs, block);
+	if (ret < 0) {
+		free(src->scratch);
+		src->scratch = NULL;
+		return ret;
+	}
+	src->ops = &loop_ops;
+	channel_cfg_str(&cfg, str, sizeof(str));
+	snprintf(src->desc, sizeof(src->desc), "loop, %u threads, %s", src->chan.nthreads, str);
+	return 0;
+}
+
+int source_open(struct source *src, const char *spec, size_t block, double fs, bool paced)
+{
+	const char *path = spec;
+	int ret;
+
+	memset(src, 0, sizeof(*src));
+	if (block == 0 || fs <= 0)
+		return -EINVAL;
+	src->block = block;
+	src->fs_hz = fs;
+	src->paced = paced;
+	src->loop = true;
+	src->sample_size = 2 * sizeof(int16_t);
+	convert_layout_native(&src->layout);
+
+	if (!strncmp(spec, "synth", 5) && (spec[5] == '\0' || spec[5] == ':'))
+		return open_synth(src, spec[5] ? spec + 6 : NULL);
+	if (source_is_iio(spec) || source_is_loopback(spec))
+		return -EINVAL;
+
+	if (!strncmp(spec, "raw:", 4)) {
+		path = spec + 4;
+		ret = open_raw(src, path);
+	} else if (!strncmp(spec, "text:", 5)) {
+		path = spec + 5;
+		ret = open_text(src, path);
+	} else {
+		if (!strncmp(spec, "file:", 5))
+			path = spec + 5;
+		ret = looks_like_text(path) ? open_text(src, path) : open_raw(src, path);
+	}
+	if (ret < 0)
+		return ret;
+	snprintf(src->desc, sizeof(src->desc), "%s %s, %zu samples", src->ops->name, path, src->total);
+	return 0;
+}
+
+int source_read(struct source *src, struct source_block *blk)
+{
+	uint64_t due, t;
+	int ret;
+
+	if (src->cancelled)
+		return -ECANCELED;
+
+	// the radio's kernel buffers are full: whole blocks that came after them are gone
+	if (src->paced && src->ops != &iio_ops && src->start_ns && src->kernel_buffers) {
+		double behind = (now_ns() - src->start_ns) * src->fs_hz / 1e9 - (src->nread + src->overruns);
+		double room = (double)src->kernel_buffers * src->block;
+
+		if (behind > room)
+			src->overruns += (uint64_t)((behind - room) / src->block) * src->block;
+	}
+
+	ret = src->ops->read(src, blk);
+	if (ret <= 0)
+		return ret;
+
+	// hold the block until the radio would have delivered its last sample
+	if (src->paced && src->ops != &iio_ops) {
+		if (!src->start_ns)
+			src->start_ns = now_ns();
+		due = src->start_ns + (uint64_t)((src->nread + src->overruns + ret) * 1e9 / src->fs_hz);
+		while (!src->cancelled && (t = now_ns()) < due) {
+			struct timespec nap = { 0, due - t < PACE_SLICE_NS ? due - t : PACE_SLICE_NS };
+
+			nanosleep(&nap, NULL);
+		}
+		if (src->cancelled)
+			return -ECANCELED;
+	}
+	src->nread += ret;
+	return ret;
+}
+
+int source_tune(struct source *src, double lo_hz)
+{
+	return src->ops->tune ? src->ops->tune(src, lo_hz) : -EOPNOTSUPP;
+}
+
+void source_cancel(struct source *src)
+{
+	src->cancelled = true;
+	src->ops->cancel(src);
+}
+
+void source_close(struct source *src)
+{
+	if (src->ops)
+		src->ops->close(src);
+	src->ops = NULL;
+}
@@ -0,0 +1,146 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Sample sources: IIO radio, file replay or synthetic signal behind one interface
+*/
+
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "channel.h"
+#include "convert.h"
+#include "fastlock.h"
+#include "nco.h"
+#include "noise.h"
+#include "ringbuf.h"
+
+#define SOURCE_FULL_SCALE 2048.0   // 12 bit ADC, normalised text values are scaled by this
+#define SOURCE_KERNEL_BUFFERS 4    // libiio's default, blocks the kernel fills ahead of a refill
+
+/* one read, laid out like a ring block: nsamples samples, step bytes apart, in len bytes at data */
+struct source_block {
+	const void *data;
+	size_t len;
+	size_t nsamples;
+	ptrdiff_t step;
+	ptrdiff_t first;   // byte offset of the I value of the first sample
+};
+
+struct source;
+
+struct source_ops {
+	const char *name;
+	/* > 0 samples in blk, 0 at the end of a non looping file, < 0 error */
+	int (*read)(struct source *src, struct source_block *blk);
+	void (*cancel)(struct source *src);
+	void (*close)(struct source *src);
+	/* moves the LO, >= 0 samples queued from before that reads will still return, NULL if fixed */
+	int (*tune)(struct source *src, double lo_hz);
+};
+
+/*
+	 Everything downstream of the capture thread only sees source_read(),
+	 so the DSP path runs the same on the radio, on a recording or on a
+	 generated signal. Files are memory mapped and replayed either paced
+	 to fs, like the radio would deliver them, or as fast as possible for
+	 benchmarks. Blocks from files point straight into the mapping where
+	 the format allows, so replay costs no copy. Paced replay also loses
+	 samples like the radio when the reader is more than kernel_buffers
+	 blocks behind; they are counted in overruns, the replay carries on
+	 from where it was.
+*/
+struct source {
+	const struct source_ops *ops;
+	struct iq_layout layout;   // how to convert the samples
+	double fs_hz;
+	double lo_hz;              // 0 if unknown
+	double bw_hz;              // 0 if unknown
+	size_t block;              // max samples per read
+	size_t sample_size;        // bytes per sample, a block is at most block * sample_size
+	bool paced;                // files and synth: deliver at fs, not faster
+	bool loop;                 // files: start again at the end
+	volatile bool cancelled;
+	uint64_t nread;            // samples delivered so far
+	uint64_t start_ns;         // pacing reference, set on the first read
+	unsigned int wraps;        // times a file was restarted
+	unsigned int kernel_buffers; // blocks queued ahead of the reader, 0: paced replay never drops
+	uint64_t overruns;         // samples paced replay dropped, as a radio with kernel_buffers would
+	char desc[256];
+
+	// iio
+	struct iio_buffer *buf;
+	const struct iio_channel *chn_i;
+	struct iio_channel *lo_chn;    // RX LO, NULL if the source can't retune
+	struct fastlock *fastlock;     // LO profiles to hop with, NULL to write the frequency
+
+	// files: int16 I/Q pairs, mapped (raw) or parsed (text)
+	void *map;
+	size_t map_len;
+	int16_t *iq;
+	size_t total;              // samples in iq
+	size_t pos;                // next sample to deliver
+
+	// synthetic
+	double tone_hz;            // RF frequency of the tone, the LO moves, the tone doesn't
+	struct nco nco;
+	struct noise noise;
+	float sigma;               // noise std deviation per component, in codes
+	int16_t *scratch;          // block generated by the last read
+	float *nbuf;
+
+	// loopback: TX blocks through the channel emulator, output in scratch
+	struct ringbuf *tx;
+	struct channel chan;
+};
+
+/*
+	 Wraps an existing, configured RX buffer; fs/lo/bw are only recorded.
+	 lo_chn is the RX LO channel source_tune() writes, NULL for none. Set
+	 fastlock afterwards to hop between calibrated frequencies instead.
+*/
+int source_open_iio(struct source *src, struct iio_buffer *buf, const struct iio_channel *chn_i,
+		const struct iio_channel *chn_q, struct iio_channel *lo_chn, size_t block,
+		double fs, double lo, double bw);
+
+/* true for specs that name an IIO context: "iio:URI", "ip:", "usb:", "local:", "serial:" */
+bool source_is_iio(const char *spec);
+
+/* true for "loop" and "loop:PARAMS" */
+bool source_is_loopback(const char *spec);
+
+/*
+	 Loopback: every read takes the next block the TX generator put in tx
+	 and returns it through the channel emulator, spec is "loop" or
+	 "loop:PARAMS" with PARAMS as for channel_cfg_parse(). TX blocks
+	 longer than block are cut short.
+*/
+int source_open_loopback(struct source *src, struct ringbuf *tx, const char *spec,
+		size_t block, double fs, bool paced);
+
+/*
+	 Opens a non IIO, non loopback source from a spec:
+	   raw:FILE     native int16 I/Q pairs, e.g. a recording, FILE.meta gives fs and lo
+	   text:FILE    "I,Q", "I, Q, " or "index I Q" lines, ints or normalised floats
+	   synth[:FREQ[,NOISE]]  tone at FREQ Hz, -6 dBFS, complex AWGN at NOISE dBFS
+	   FILE         raw or text, guessed from the content
+	 fs is used where the file doesn't say.
+*/
+int source_open(struct source *src, const char *spec, size_t block, double fs, bool paced);
+
+int source_read(struct source *src, struct source_block *blk);
+/*
+	 Retunes the radio, or the synthetic source's view of a fixed RF tone.
+	 Returns how many samples reads will still deliver from before the
+	 retune, the caller discards those plus the PLL settling time.
+	 -EOPNOTSUPP for files and loopback.
+*/
+int source_tune(struct source *src, double lo_hz);
+/* makes a blocked or paced read return, from any thread */
+void source_cancel(struct source *src);
+void source_close(struct source *src);
+
+#endif
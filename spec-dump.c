@@ -0,0 +1,152 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Spectrum file dump: header, frame list, or frames as text for gnuplot
+*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "specfile.h"
+
+static long frame = -1;
+static bool all_frames;
+static bool absolute;
+static const char *out_path;
+
+static void usage(int argc, char *argv[])
+{
+	printf("Usage: %s [OPTION] FILE\n", argv[0]);
+	printf("  -f\tprint frame N (0 based) as \"freq dB\" lines\n");
+	printf("  -a\twrite every frame to fft-<N+1>.txt, the layout the table*.gp scripts plot\n");
+	printf("  -o\twrite -f output to a file instead of stdout\n");
+	printf("  -l\tadd the LO to the frequency column\n");
+	printf("Without -f or -a the header and frame list are printed.\n");
+}
+
+static void parse_options(int argc, char *argv[])
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "f:ao:lh")) != -1) {
+		switch (c)
+		{
+		case 'f':
+			frame = atol(optarg);
+			break;
+		case 'a':
+			all_frames = true;
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		case 'l':
+			absolute = true;
+			break;
+		case 'h':
+		default:
+			usage(argc, argv);
+			exit(1);
+		}
+	}
+	if (optind != argc - 1) {
+		usage(argc, argv);
+		exit(1);
+	}
+}
+
+static int write_text(struct specfile *sf, size_t k, float *bins, FILE *fp)
+{
+	double lo = absolute ? sf->hdr.lo_hz : 0;
+	size_t i;
+	int ret;
+
+	ret = specfile_read(sf, k, NULL, bins);
+	if (ret < 0)
+		return ret;
+	for (i = 0; i < sf->hdr.nfft; i++)
+		fprintf(fp, "%lf %lf\n", lo + specfile_bin_freq(&sf->hdr, i), bins[i]);
+	return 0;
+}
+
+static void print_header(struct specfile *sf)
+{
+	const struct spec_header *h = &sf->hdr;
+	time_t start = h->start_ns / 1000000000ull;
+	struct spec_frame fr;
+	char when[64];
+	size_t k;
+
+	strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&start));
+	printf("* Started %s, %zu frames%s\n", when, specfile_frames(sf),
+		h->index_offset ? "" : " (not closed, no index)");
+	printf("  FFT size: %llu, %s window, %.0f%% overlap, ENBW %.3f bins, %s dB\n",
+		(unsigned long long) h->nfft, h->window, h->overlap * 100, h->enbw, h->db_mode);
+	printf("  Sample rate: %.0f Hz, bin %.3f Hz\n  LO frequency: %.0f Hz\n  Bandwidth: %.0f Hz\n",
+		h->fs_hz, h->fs_hz / h->nfft, h->lo_hz, h->bw_hz);
+
+	for (k = 0; k < specfile_frames(sf); k++) {
+		if (specfile_read(sf, k, &fr, sf->bins) < 0)
+			break;
+		printf("%6zu %12.3f s  seq %8llu  %6u segments%s\n", k,
+			(fr.timestamp_ns - h->start_ns) / 1e9, (unsigned long long) fr.seq,
+			fr.nseg, fr.flags & SPEC_FRAME_GAP ? "  gap" : "");
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct specfile sf;
+	char name[64];
+	float *bins;
+	FILE *fp;
+	size_t k;
+	int ret;
+
+	parse_options(argc, argv);
+
+	ret = specfile_open(&sf, argv[optind]);
+	if (ret < 0) {
+		fprintf(stderr, "Could not open %s: %s\n", argv[optind], strerror(-ret));
+		return 1;
+	}
+	bins = malloc(sizeof(float) * sf.hdr.nfft);
+	if (!bins) {
+		perror("Could not allocate frame");
+		return 1;
+	}
+
+	if (frame >= 0) {
+		fp = out_path ? fopen(out_path, "w") : stdout;
+		if (!fp) {
+			perror("Could not create output");
+			return 1;
+		}
+		ret = write_text(&sf, frame, bins, fp);
+		if (fp != stdout)
+			fclose(fp);
+	} else if (all_frames) {
+		for (k = 0; k < specfile_frames(&sf) && ret >= 0; k++) {
+			snprintf(name, sizeof(name), "fft-%zu.txt", k + 1);
+			fp = fopen(name, "w");
+			if (!fp) {
+				perror("Could not create output");
+				return 1;
+			}
+			ret = write_text(&sf, k, bins, fp);
+			fclose(fp);
+		}
+	} else {
+		print_header(&sf);
+	}
+
+	if (ret < 0)
+		fprintf(stderr, "Could not read frame: %s\n", strerror(-ret));
+	free(bins);
+	specfile_close(&sf);
+	return ret < 0;
+}
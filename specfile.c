@@ -0,0 +1,196 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Binary spectrum container: one header, float32 frames, frame index
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "specfile.h"
+
+_Static_assert(sizeof(struct spec_header) == 128, "spec_header layout changed");
+_Static_assert(sizeof(struct spec_frame) == 24, "spec_frame layout changed");
+
+static uint64_t realtime_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static size_t frame_bytes(const struct spec_header *hdr)
+{
+	return sizeof(struct spec_frame) + hdr->nfft * sizeof(float);
+}
+
+static int errno_or(int fallback)
+{
+	return errno ? -errno : fallback;
+}
+
+int specfile_create(struct specfile *sf, const char *path, const struct spec_header *hdr)
+{
+	memset(sf, 0, sizeof(*sf));
+	if (hdr->nfft == 0)
+		return -EINVAL;
+
+	sf->hdr = *hdr;
+	memcpy(sf->hdr.magic, SPEC_MAGIC, sizeof(sf->hdr.magic));
+	sf->hdr.version = SPEC_VERSION;
+	sf->hdr.header_size = sizeof(struct spec_header);
+	sf->hdr.start_ns = realtime_ns();
+	sf->hdr.nframes = 0;
+	sf->hdr.index_offset = 0;
+
+	sf->bins = malloc(sizeof(float) * hdr->nfft);
+	if (!sf->bins)
+		return -ENOMEM;
+
+	sf->fp = fopen(path, "wb");
+	if (!sf->fp) {
+		int ret = -errno;
+
+		free(sf->bins);
+		sf->bins = NULL;
+		return ret;
+	}
+	sf->writing = true;
+
+	// a frame is 4 MiB at 1M bins, let stdio pass it straight through
+	setvbuf(sf->fp, NULL, _IOFBF, 1 << 20);
+	if (fwrite(&sf->hdr, sizeof(sf->hdr), 1, sf->fp) != 1) {
+		int ret = errno_or(-EIO);
+
+		specfile_close(sf);
+		return ret;
+	}
+	return 0;
+}
+
+int specfile_write(struct specfile *sf, const sample_t *db, uint64_t seq, uint32_t nseg,
+		uint32_t flags)
+{
+	struct spec_frame frame;
+	size_t k;
+
+	if (sf->nindex == sf->cap) {
+		size_t cap = sf->cap ? sf->cap * 2 : 64;
+		struct spec_index *index = realloc(sf->index, cap * sizeof(*index));
+
+		if (!index)
+			return -ENOMEM;
+		sf->index = index;
+		sf->cap = cap;
+	}
+
+	frame.timestamp_ns = realtime_ns();
+	frame.seq = seq;
+	frame.nseg = nseg;
+	frame.flags = flags;
+	sf->index[sf->nindex].offset = sf->hdr.header_size + sf->nindex * frame_bytes(&sf->hdr);
+	sf->index[sf->nindex].timestamp_ns = frame.timestamp_ns;
+
+	for (k = 0; k < sf->hdr.nfft; k++)
+		sf->bins[k] = db[k];
+	if (fwrite(&frame, sizeof(frame), 1, sf->fp) != 1 ||
+	    fwrite(sf->bins, sizeof(float), sf->hdr.nfft, sf->fp) != sf->hdr.nfft)
+		return errno_or(-EIO);
+	sf->nindex++;
+	return 0;
+}
+
+int specfile_open(struct specfile *sf, const char *path)
+{
+	long end;
+	int ret = -EINVAL;
+
+	memset(sf, 0, sizeof(*sf));
+	sf->fp = fopen(path, "rb");
+	if (!sf->fp)
+		return -errno;
+
+	if (fread(&sf->hdr, sizeof(sf->hdr), 1, sf->fp) != 1 ||
+	    memcmp(sf->hdr.magic, SPEC_MAGIC, sizeof(sf->hdr.magic)) ||
+	    sf->hdr.version != SPEC_VERSION || sf->hdr.nfft == 0 ||
+	    sf->hdr.header_size < sizeof(sf->hdr))
+		goto fail;
+
+	sf->bins = malloc(sizeof(float) * sf->hdr.nfft);
+	if (!sf->bins) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	if (sf->hdr.index_offset) {
+		sf->nindex = sf->hdr.nframes;
+		sf->index = calloc(sf->nindex ? sf->nindex : 1, sizeof(*sf->index));
+		if (!sf->index) {
+			ret = -ENOMEM;
+			goto fail;
+		}
+		if (fseek(sf->fp, sf->hdr.index_offset, SEEK_SET) ||
+		    fread(sf->index, sizeof(*sf->index), sf->nindex, sf->fp) != sf->nindex)
+			goto fail;
+	} else {
+		// never closed, every complete frame is still where it should be
+		if (fseek(sf->fp, 0, SEEK_END) || (end = ftell(sf->fp)) < 0)
+			goto fail;
+		sf->nindex = (end - sf->hdr.header_size) / frame_bytes(&sf->hdr);
+		sf->hdr.nframes = sf->nindex;
+	}
+	sf->cap = sf->nindex;
+	return 0;
+
+fail:
+	specfile_close(sf);
+	return ret;
+}
+
+size_t specfile_frames(const struct specfile *sf)
+{
+	return sf->nindex;
+}
+
+int specfile_read(struct specfile *sf, size_t k, struct spec_frame *frame, float *bins)
+{
+	struct spec_frame tmp;
+	long offset;
+
+	if (k >= sf->nindex)
+		return -EINVAL;
+	offset = sf->index ? (long)sf->index[k].offset
+		: (long)(sf->hdr.header_size + k * frame_bytes(&sf->hdr));
+	if (fseek(sf->fp, offset, SEEK_SET) ||
+	    fread(frame ? frame : &tmp, sizeof(tmp), 1, sf->fp) != 1 ||
+	    fread(bins, sizeof(float), sf->hdr.nfft, sf->fp) != sf->hdr.nfft)
+		return -EIO;
+	return 0;
+}
+
+int specfile_close(struct specfile *sf)
+{
+	int ret = 0;
+
+	if (sf->fp && sf->writing) {
+		long offset = ftell(sf->fp);
+
+		// index last, then patch the header so readers know it is there
+		sf->hdr.nframes = sf->nindex;
+		sf->hdr.index_offset = offset;
+		if (offset < 0 ||
+		    fwrite(sf->index, sizeof(*sf->index), sf->nindex, sf->fp) != sf->nindex ||
+		    fseek(sf->fp, 0, SEEK_SET) ||
+		    fwrite(&sf->hdr, sizeof(sf->hdr), 1, sf->fp) != 1)
+			ret = errno_or(-EIO);
+	}
+	if (sf->fp && fclose(sf->fp) && !ret)
+		ret = -errno;
+	free(sf->index);
+	free(sf->bins);
+	memset(sf, 0, sizeof(*sf));
+	return ret;
+}
@@ -0,0 +1,95 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Binary spectrum container: one header, float32 frames, frame index
+*/
+
+#ifndef SPECFILE_H
+#define SPECFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "dsp.h"
+
+#define SPEC_MAGIC "SPECTRUM"
+#define SPEC_VERSION 1
+
+/*
+	 File layout, all fields in host byte order (little endian on every
+	 target we run on):
+
+	   struct spec_header                         128 bytes
+	   frame 0: struct spec_frame + nfft float32 bins
+	   frame 1: ...
+	   nframes x struct spec_index                written on close
+
+	 Bins are dB, fftshifted: bin k is at (k - nfft/2) * fs / nfft Hz from
+	 the LO, so no frequency column is stored. A stitched sweep is stored
+	 the same way, nfft is then its bin count, fs its span and lo its
+	 centre. Frames are fixed size, a file that was not closed cleanly
+	 (no index, nframes 0) is still readable.
+*/
+struct spec_header {
+	char magic[8];           // SPEC_MAGIC, not terminated
+	uint32_t version;
+	uint32_t header_size;    // sizeof(struct spec_header)
+	uint64_t nfft;
+	double fs_hz;            // sample rate, sets the bin spacing
+	double lo_hz;            // centre frequency
+	double bw_hz;            // analog filter bandwidth
+	double overlap;          // Welch segment overlap, fraction of nfft
+	double enbw;             // window noise bandwidth in bins
+	uint64_t start_ns;       // CLOCK_REALTIME when the file was created
+	uint64_t nframes;        // filled in on close
+	uint64_t index_offset;   // file offset of the index, 0 if missing
+	char window[24];         // window name, NUL terminated
+	char db_mode[8];         // "exact" or "fast"
+	uint8_t reserved[8];
+};
+
+struct spec_frame {
+	uint64_t timestamp_ns;   // CLOCK_REALTIME at the end of the frame
+	uint64_t seq;            // first RX block of the frame
+	uint32_t nseg;           // segments averaged
+	uint32_t flags;          // SPEC_FRAME_*
+};
+
+#define SPEC_FRAME_GAP 1     // RX blocks were dropped inside this frame
+
+struct spec_index {
+	uint64_t offset;         // of the struct spec_frame
+	uint64_t timestamp_ns;
+};
+
+struct specfile {
+	FILE *fp;
+	bool writing;
+	struct spec_header hdr;
+	struct spec_index *index;
+	size_t nindex;
+	size_t cap;
+	float *bins;             // conversion scratch, nfft long
+};
+
+/* header fields other than magic/version/sizes/start/nframes/index are the caller's */
+int specfile_create(struct specfile *sf, const char *path, const struct spec_header *hdr);
+int specfile_write(struct specfile *sf, const sample_t *db, uint64_t seq, uint32_t nseg,
+		uint32_t flags);
+
+int specfile_open(struct specfile *sf, const char *path);
+/* reads frame k, bins must hold hdr.nfft floats, frame may be NULL */
+int specfile_read(struct specfile *sf, size_t k, struct spec_frame *frame, float *bins);
+size_t specfile_frames(const struct specfile *sf);
+
+/* writes the index and the final header when writing */
+int specfile_close(struct specfile *sf);
+
+static inline double specfile_bin_freq(const struct spec_header *hdr, size_t k)
+{
+	return ((double)k - (double)(hdr->nfft / 2)) * hdr->fs_hz / hdr->nfft;
+}
+
+#endif
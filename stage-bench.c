@@ -0,0 +1,348 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Stage benchmark: every DSP stage on the captured data, each SIMD kernel against scalar
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dsp.h"
+#include "convert.h"
+#include "fftplan.h"
+#include "welch.h"
+#include "db.h"
+#include "specfile.h"
+#include "source.h"
+
+#define RX_FS 30.72e6          // real time budget, samples per second
+#define BENCH_SAMPLES (1024*1024)
+#define FFT_BATCH_BELOW 65536  // same rule as the spectrum tool
+#define OUT_TEXT "stage-bench.txt"
+#define OUT_SPEC "stage-bench.spec"
+
+static const char *const kernel_names[] = { "avx2", "sse2", "scalar" };
+static const size_t fft_sizes[] = { 16384, 65536, 1024*1024 };
+
+static enum plan_rigor plan_rigor = PLAN_MEASURE;
+static int fft_threads = 1;
+static double seconds = 0.2;
+
+/* everything one stage may touch, BENCH_SAMPLES long */
+struct bench {
+	int16_t *raw;              // interleaved I/Q from the capture file
+	struct iq_layout layout;
+	fft_complex *x;            // converted samples
+	fft_complex *y;            // windowed / transformed
+	sample_t *win;
+	sample_t *acc;
+	sample_t *db;
+	sample_t *tmp;
+};
+
+static void usage(int argc, char *argv[])
+{
+	printf("Usage: %s [OPTION] FILE...\n", argv[0]);
+	printf("  FILE\tcapture to run on: raw int16, \"I,Q\" or \"index I Q\" text (raw.dat, iq.dat, input.csv)\n");
+	printf("  -p\tFFT planner rigor: estimate, measure, patient, exhaustive (default measure)\n");
+	printf("  -w\tFFTW wisdom cache directory (default ~/.cache/spectrum)\n");
+	printf("  -t\tFFT threads (default 1, the per stage cost on one core)\n");
+	printf("  -s\tseconds to run each point (default 0.2)\n");
+}
+
+static void parse_options(int argc, char *argv[])
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "p:w:t:s:h")) != -1) {
+		switch (c)
+		{
+		case 'p':
+			if (fftplan_rigor_parse(optarg) < 0) {
+				usage(argc, argv);
+				exit(1);
+			}
+			plan_rigor = fftplan_rigor_parse(optarg);
+			break;
+		case 'w':
+			fftplan_set_cache_dir(optarg);
+			break;
+		case 't':
+			fft_threads = atoi(optarg);
+			break;
+		case 's':
+			seconds = atof(optarg);
+			break;
+		case 'h':
+		default:
+			usage(argc, argv);
+			exit(1);
+		}
+	}
+	if (optind >= argc) {
+		usage(argc, argv);
+		exit(1);
+	}
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* runs the body until seconds have passed, sets per to the seconds per run */
+#define TIME_LOOP(per, ...) do { \
+	double t0_, t_; \
+	size_t runs_ = 0; \
+	__VA_ARGS__; /* warm up caches */ \
+	t0_ = now(); \
+	do { \
+		__VA_ARGS__; \
+		runs_++; \
+		t_ = now() - t0_; \
+	} while (t_ < seconds); \
+	(per) = t_ / runs_; \
+} while (0)
+
+static void report(const char *stage, const char *variant, size_t n, double per, double base)
+{
+	printf("%-10s %-16s %10.3f %10.2f %8.2f %8.2f\n", stage, variant, per * 1e9 / n,
+		n / per / 1e6, n / per / RX_FS, base > 0 ? base / per : 1.0);
+}
+
+/* loads up to BENCH_SAMPLES samples, short files are repeated */
+static int load(struct bench *b, const char *path)
+{
+	struct source src;
+	struct source_block blk;
+	size_t have = 0;
+	int ret;
+
+	ret = source_open(&src, path, BENCH_SAMPLES, RX_FS, false);
+	if (ret < 0)
+		return ret;
+	printf("* %s\n", src.desc);
+	while (have < BENCH_SAMPLES) {
+		size_t n;
+
+		ret = source_read(&src, &blk);
+		if (ret <= 0)
+			break;
+		n = BENCH_SAMPLES - have < blk.nsamples ? BENCH_SAMPLES - have : blk.nsamples;
+		memcpy(b->raw + 2*have, (const char *)blk.data + blk.first, n * blk.step);
+		have += n;
+	}
+	b->layout = src.layout;
+	source_close(&src);
+	return have == BENCH_SAMPLES ? 0 : -ENODATA;
+}
+
+static void bench_convert(struct bench *b)
+{
+	double per, base = 0;
+	int i;
+
+	// scalar first, it is the base of the speedup column
+	for (i = sizeof(kernel_names)/sizeof(kernel_names[0]) - 1; i >= 0; i--) {
+		if (!convert_select(kernel_names[i]))
+			continue;
+		TIME_LOOP(per, convert_iq(&b->layout, b->x, BENCH_SAMPLES, b->raw, BENCH_SAMPLES,
+			2 * sizeof(int16_t), 1.0));
+		if (!base)
+			base = per;
+		report("convert", kernel_names[i], BENCH_SAMPLES, per, base);
+	}
+	convert_init();
+}
+
+static void bench_window(struct bench *b)
+{
+	double per;
+	size_t n;
+
+	// one 1M segment, the pass is the same whatever the segment length
+	for (n = 0; n < BENCH_SAMPLES; n++)
+		b->win[n] = 0.5 - 0.5 * cos(2 * M_PI * n / BENCH_SAMPLES);
+	TIME_LOOP(per, welch_apply_window(b->y, b->x, b->win, BENCH_SAMPLES));
+	report("window", "hann", BENCH_SAMPLES, per, 0);
+}
+
+static void bench_fft(struct bench *b)
+{
+	struct plan_info pinfo;
+	char name[32];
+	fft_plan plan;
+	double per;
+	size_t i;
+
+	fftplan_set_threads(fft_threads);
+	for (i = 0; i < sizeof(fft_sizes)/sizeof(fft_sizes[0]); i++) {
+		size_t n = fft_sizes[i];
+		size_t batch = n < FFT_BATCH_BELOW ? BENCH_SAMPLES / n : 1;
+
+		plan = fftplan_dft_batch(n, batch, b->y, b->y, plan_rigor, &pinfo);
+		if (!plan) {
+			fprintf(stderr, "Could not plan %zu point FFT\n", n);
+			continue;
+		}
+		// planning may have scribbled over the buffer
+		welch_apply_window(b->y, b->x, b->win, BENCH_SAMPLES);
+		TIME_LOOP(per, FFTW(execute)(plan));
+		snprintf(name, sizeof(name), "%zu x%zu", n, batch);
+		report("fft", name, n * batch, per, 0);
+		FFTW(destroy_plan)(plan);
+	}
+}
+
+/* |X|^2 summed into the Welch accumulator */
+static void bench_average(struct bench *b)
+{
+	double per, base = 0;
+	int i;
+
+	memset(b->acc, 0, sizeof(sample_t) * BENCH_SAMPLES);
+	for (i = sizeof(kernel_names)/sizeof(kernel_names[0]) - 1; i >= 0; i--) {
+		if (!db_select(kernel_names[i]))
+			continue;
+		TIME_LOOP(per, db_accumulate(b->acc, b->y, BENCH_SAMPLES));
+		if (!base)
+			base = per;
+		report("average", kernel_names[i], BENCH_SAMPLES, per, base);
+	}
+	db_init();
+}
+
+static void bench_db(struct bench *b)
+{
+	enum db_mode modes[] = { DB_EXACT, DB_FAST };
+	char name[32];
+	double per, base;
+	unsigned int m;
+	int i;
+
+	for (m = 0; m < sizeof(modes)/sizeof(modes[0]); m++) {
+		base = 0;
+		for (i = sizeof(kernel_names)/sizeof(kernel_names[0]) - 1; i >= 0; i--) {
+			if (!db_select(kernel_names[i]))
+				continue;
+			TIME_LOOP(per, db_power(b->db, b->acc, BENCH_SAMPLES, 0, modes[m]));
+			if (!base)
+				base = per;
+			snprintf(name, sizeof(name), "%s %s", kernel_names[i], db_mode_name(modes[m]));
+			report("db", name, BENCH_SAMPLES, per, base);
+		}
+	}
+	db_init();
+}
+
+/* what a separate shift pass would cost, the pipeline folds it into the dB pass */
+static void bench_shift(struct bench *b)
+{
+	size_t half = (BENCH_SAMPLES + 1) / 2;
+	double per;
+
+	TIME_LOOP(per, {
+		memcpy(b->tmp, b->db + half, sizeof(sample_t) * (BENCH_SAMPLES - half));
+		memcpy(b->tmp + BENCH_SAMPLES - half, b->db, sizeof(sample_t) * half);
+	});
+	report("fftshift", "separate pass", BENCH_SAMPLES, per, 0);
+}
+
+/* one frame of BENCH_SAMPLES bins: the old fft.dat text against the spectrum file */
+static void bench_output(struct bench *b)
+{
+	struct spec_header hdr;
+	struct specfile sf;
+	double per, base;
+	uint64_t seq = 0;
+	size_t k;
+	FILE *fp;
+
+	for (k = 0; k < BENCH_SAMPLES; k++)
+		b->tmp[k] = ((double)k - BENCH_SAMPLES/2) * RX_FS / BENCH_SAMPLES;
+	fp = fopen(OUT_TEXT, "w");
+	if (!fp) {
+		perror("Could not create " OUT_TEXT);
+		return;
+	}
+	TIME_LOOP(base, {
+		rewind(fp);
+		for (k = 0; k < BENCH_SAMPLES; k++)
+			fprintf(fp, "%f %f\n", b->tmp[k], b->db[k]);
+		fflush(fp);
+	});
+	fclose(fp);
+	unlink(OUT_TEXT);
+	report("output", "text", BENCH_SAMPLES, base, 0);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.nfft = BENCH_SAMPLES;
+	hdr.fs_hz = RX_FS;
+	if (specfile_create(&sf, OUT_SPEC, &hdr) < 0) {
+		perror("Could not create " OUT_SPEC);
+		return;
+	}
+	TIME_LOOP(per, specfile_write(&sf, b->db, seq++, 1, 0));
+	specfile_close(&sf);
+	unlink(OUT_SPEC);
+	report("output", "spectrum file", BENCH_SAMPLES, per, base);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench b;
+	int i, ret;
+
+	parse_options(argc, argv);
+
+	b.raw = malloc(sizeof(int16_t) * 2 * BENCH_SAMPLES);
+	b.x = FFTW(malloc)(sizeof(fft_complex) * BENCH_SAMPLES);
+	b.y = FFTW(malloc)(sizeof(fft_complex) * BENCH_SAMPLES);
+	b.win = FFTW(malloc)(sizeof(sample_t) * BENCH_SAMPLES);
+	b.acc = FFTW(malloc)(sizeof(sample_t) * BENCH_SAMPLES);
+	b.db = FFTW(malloc)(sizeof(sample_t) * BENCH_SAMPLES);
+	b.tmp = FFTW(malloc)(sizeof(sample_t) * BENCH_SAMPLES);
+	if (!b.raw || !b.x || !b.y || !b.win || !b.acc || !b.db || !b.tmp) {
+		perror("Could not allocate benchmark buffers");
+		return 1;
+	}
+
+	printf("* %s precision, %zu samples per run, %d FFT threads, real time = %.2f MS/s\n",
+		PRECISION_NAME, (size_t)BENCH_SAMPLES, fft_threads, RX_FS / 1e6);
+	printf("* Kernels: convert %s, power %s\n", convert_init(), db_init());
+
+	for (i = optind; i < argc; i++) {
+		ret = load(&b, argv[i]);
+		if (ret < 0) {
+			fprintf(stderr, "Could not load %s: %s\n", argv[i], strerror(-ret));
+			continue;
+		}
+		printf("%-10s %-16s %10s %10s %8s %8s\n", "stage", "variant", "ns/smp", "MS/s",
+			"x rt", "speedup");
+		bench_convert(&b);
+		bench_window(&b);
+		bench_fft(&b);
+		bench_average(&b);
+		bench_db(&b);
+		bench_shift(&b);
+		bench_output(&b);
+	}
+
+	free(b.raw);
+	FFTW(free)(b.x);
+	FFTW(free)(b.y);
+	FFTW(free)(b.win);
+	FFTW(free)(b.acc);
+	FFTW(free)(b.db);
+	FFTW(free)(b.tmp);
+	return 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Swept wideband spectrum: LO plan and stitching of per step spectra
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sweep.h"
+
+int sweep_init(struct sweep *sw, double start, double stop, double fs, size_t nfft, double keep)
+{
+	double bin = fs / nfft, last;
+	unsigned int k;
+
+	memset(sw, 0, sizeof(*sw));
+	if (stop <= start || fs <= 0 || nfft < 16 || keep <= 0 || keep > 1)
+		return -EINVAL;
+
+	sw->start_hz = start;
+	sw->fs_hz = fs;
+	sw->nfft = nfft;
+	sw->nkeep = keep * nfft;
+	if (sw->nkeep < 1)
+		sw->nkeep = 1;
+	sw->step_hz = sw->nkeep * bin;
+	sw->nsteps = ceil((stop - start) / sw->step_hz);
+	if ((double)sw->nsteps * sw->nkeep > SWEEP_MAX_BINS)
+		return -E2BIG;
+	// the last LO sits half a step past stop at most, shift the plan down if that is off the top
+	last = start + ((double)(sw->nsteps - 1) * sw->nkeep + sw->nkeep / 2) * bin;
+	if (last > SWEEP_LO_MAX) {
+		start -= last - SWEEP_LO_MAX;
+		sw->start_hz = start;
+	}
+	if (start + (sw->nkeep / 2) * bin < SWEEP_LO_MIN)
+		return -EINVAL;
+	sw->nbins = (size_t)sw->nsteps * sw->nkeep;
+	sw->span_hz = sw->nbins * bin;
+	sw->centre_hz = start + (sw->nbins / 2) * bin;
+
+	sw->lo = malloc(sizeof(double) * sw->nsteps);
+	sw->out = malloc(sizeof(sample_t) * sw->nbins);
+	if (!sw->lo || !sw->out) {
+		sweep_free(sw);
+		return -ENOMEM;
+	}
+	// LO in the middle of each kept band, DC is bin nfft/2 of the step
+	for (k = 0; k < sw->nsteps; k++)
+		sw->lo[k] = start + ((double)k * sw->nkeep + sw->nkeep / 2) * bin;
+	memset(sw->out, 0, sizeof(sample_t) * sw->nbins);
+	return 0;
+}
+
+void sweep_free(struct sweep *sw)
+{
+	free(sw->lo);
+	free(sw->out);
+	sw->lo = NULL;
+	sw->out = NULL;
+}
+
+bool sweep_add(struct sweep *sw, unsigned int step, const sample_t *db)
+{
+	if (step >= sw->nsteps)
+		return false;
+	memcpy(sw->out + (size_t)step * sw->nkeep, db + sw->nfft / 2 - sw->nkeep / 2,
+		sizeof(sample_t) * sw->nkeep);
+	sw->filled++;
+	if (step != sw->nsteps - 1)
+		return false;
+	sw->missing = sw->filled < sw->nsteps ? sw->nsteps - sw->filled : 0;
+	sw->filled = 0;
+	sw->sweeps++;
+	return true;
+}
@@ -0,0 +1,65 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Swept wideband spectrum: LO plan and stitching of per step spectra
+*/
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "dsp.h"
+
+#define SWEEP_MAX_BINS (64*1024*1024)   // composite spectrum limit
+#define SWEEP_LO_MIN 70e6                // AD9361 RX LO range
+#define SWEEP_LO_MAX 6e9
+
+/*
+	 Only the flat centre of each step is kept, keep * fs wide, and the
+	 steps are spaced by exactly that width, so kept bins of neighbouring
+	 steps line up on one grid of fs / nfft spacing starting at start_hz.
+	 The composite bin i is at start_hz + i * fs / nfft, which is what a
+	 spectrum file header of nfft = nbins, fs = span_hz, lo = centre_hz
+	 describes, so spec-dump needs no sweep awareness.
+*/
+struct sweep {
+	double start_hz;
+	double fs_hz;
+	size_t nfft;
+	size_t nkeep;            // bins kept per step
+	double step_hz;          // LO spacing, nkeep bins wide
+	unsigned int nsteps;
+	double *lo;              // LO frequency of each step
+	size_t nbins;            // nsteps * nkeep
+	double span_hz;          // nbins * fs / nfft
+	double centre_hz;        // frequency of composite bin nbins / 2
+	sample_t *out;           // composite dB spectrum, nbins long
+
+	unsigned int filled;     // steps added to the current sweep
+	unsigned int missing;    // steps the last completed sweep lacked
+	unsigned int sweeps;     // completed sweeps
+};
+
+/*
+	 Plans steps covering start to stop at fs with nfft point spectra, keep
+	 is the fraction of each step's band that is used. Steps whose LO would
+	 pass SWEEP_LO_MAX move down together, start_hz with them, so the
+	 composite still covers stop. -EINVAL for an empty range, a keep
+	 outside (0, 1] or an LO plan that doesn't fit SWEEP_LO_MIN to
+	 SWEEP_LO_MAX, -E2BIG when the composite would have more than
+	 SWEEP_MAX_BINS bins.
+*/
+int sweep_init(struct sweep *sw, double start, double stop, double fs, size_t nfft, double keep);
+void sweep_free(struct sweep *sw);
+
+/*
+	 Copies the kept centre of step's fftshifted spectrum (welch_average_db()
+	 output, nfft bins) into the composite. Returns true when it was the
+	 last step, the composite in out is then a complete sweep; steps that
+	 never arrived keep the previous sweep's bins and are counted in missing.
+*/
+bool sweep_add(struct sweep *sw, unsigned int step, const sample_t *db);
+
+#endif
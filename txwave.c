@@ -0,0 +1,65 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * TX test waveforms, built once and replayed by a cyclic IIO buffer
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "txwave.h"
+
+int txwave_tones(struct txwave *w, double fs, const double *freq, const double *ampl,
+		unsigned int ntones, size_t nsamples)
+{
+	struct nco nco;
+	unsigned int t, bits = 0;
+
+	memset(w, 0, sizeof(*w));
+	if (nsamples == 0 || (nsamples & (nsamples - 1)) || nsamples > (1ull << 32) ||
+	    fs <= 0 || ntones > NCO_MAX_TONES)
+		return -EINVAL;
+	while ((1ull << bits) < nsamples)
+		bits++;
+
+	w->iq = malloc(sizeof(int16_t) * 2 * nsamples);
+	if (!w->iq)
+		return -ENOMEM;
+	w->nsamples = nsamples;
+	w->fs_hz = fs;
+	w->ntones = ntones;
+
+	// whole cycles per buffer, a multiple of 2^(32 - bits) in phase steps
+	nco_reset(&nco, fs);
+	for (t = 0; t < ntones; t++) {
+		uint64_t cycles = (uint64_t)llround(freq[t] * nsamples / fs) & (nsamples - 1);
+
+		nco_add_step(&nco, (uint32_t)(cycles << (32 - bits)), ampl[t]);
+		w->freq_hz[t] = nco_freq(&nco, t);
+	}
+	nco_generate(&nco, w->iq, nsamples);
+	return 0;
+}
+
+void txwave_free(struct txwave *w)
+{
+	free(w->iq);
+	memset(w, 0, sizeof(*w));
+}
+
+void txwave_load(const struct txwave *w, struct iio_buffer *buf, const struct iio_channel *chn_i)
+{
+	ptrdiff_t p_inc = iio_buffer_step(buf);
+	char *p_end = iio_buffer_end(buf);
+	char *p_dat;
+	size_t k = 0;
+
+	for (p_dat = iio_buffer_first(buf, chn_i); p_dat < p_end; p_dat += p_inc) {
+		((int16_t *)p_dat)[0] = w->iq[2*k];
+		((int16_t *)p_dat)[1] = w->iq[2*k + 1];
+		if (++k == w->nsamples)
+			k = 0;
+	}
+}
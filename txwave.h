@@ -0,0 +1,45 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * TX test waveforms, built once and replayed by a cyclic IIO buffer
+*/
+
+#ifndef TXWAVE_H
+#define TXWAVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nco.h"
+
+#ifdef __APPLE__
+#include <iio/iio.h>
+#else
+#include <iio.h>
+#endif
+
+/*
+	 A cyclic buffer repeats forever, so the waveform has to end exactly
+	 where it starts or every wrap puts a phase jump (and spurs) on the
+	 air. The length is a power of two and every tone is snapped to the
+	 fs / nsamples grid, so the NCO phase steps add up to whole turns over
+	 the buffer. With nsamples equal to the FFT size the tones also sit on
+	 bin centres.
+*/
+struct txwave {
+	int16_t *iq;         // interleaved I, Q
+	size_t nsamples;
+	double fs_hz;
+	unsigned int ntones;
+	double freq_hz[NCO_MAX_TONES];   // frequencies actually generated
+};
+
+/* sum of tones I = A cos, Q = A sin, a positive freq is above the LO */
+int txwave_tones(struct txwave *w, double fs, const double *freq, const double *ampl,
+		unsigned int ntones, size_t nsamples);
+void txwave_free(struct txwave *w);
+
+/* copies the waveform into a TX buffer of any length, repeating it as needed */
+void txwave_load(const struct txwave *w, struct iio_buffer *buf, const struct iio_channel *chn_i);
+
+#endif
@@ -0,0 +1,274 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Streaming Welch power spectrum: windowed, overlapped, averaged segments
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "welch.h"
+
+#define MAX_BATCH 256   // bounds the seg array for tiny FFT sizes
+
+/* cosine sum windows, w[n] = a0 - a1 cos(x) + a2 cos(2x) - a3 cos(3x) + a4 cos(4x) */
+static const struct {
+	const char *name;
+	double a[5];
+} windows[] = {
+	[WINDOW_RECT]            = { "rect",            { 1.0 } },
+	[WINDOW_HANN]            = { "hann",            { 0.5, 0.5 } },
+	[WINDOW_BLACKMAN_HARRIS] = { "blackman-harris", { 0.35875, 0.48829, 0.14128, 0.01168 } },
+	[WINDOW_FLATTOP]         = { "flattop",         { 0.21557895, 0.41663158, 0.277263158,
+	                                                  0.083578947, 0.006947368 } },
+};
+
+int welch_window_parse(const char *s)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(windows)/sizeof(windows[0]); i++)
+		if (!strcmp(s, windows[i].name))
+			return i;
+	return -1;
+}
+
+const char *welch_window_name(enum window_type w)
+{
+	return windows[w].name;
+}
+
+static void make_window(struct welch *w)
+{
+	const double *a = windows[w->window].a;
+	size_t n;
+
+	for (n = 0; n < w->nfft; n++) {
+		// periodic window, the right choice for spectral analysis
+		double x = 2 * M_PI * n / w->nfft;
+
+		w->win[n] = a[0] - a[1]*cos(x) + a[2]*cos(2*x) - a[3]*cos(3*x) + a[4]*cos(4*x);
+	}
+}
+
+/*
+	 Window tables are cached next to the FFT wisdom, one file per window,
+	 precision and length. Reading 1M points back is several times faster
+	 than the cos() calls, and a table only ever has one writer thanks to
+	 the rename.
+*/
+static void window_path(const struct welch *w, char *buf, size_t len)
+{
+	char name[64];
+
+	snprintf(name, sizeof(name), "window-%s-%s-%zu.tab", windows[w->window].name,
+		PRECISION_NAME, w->nfft);
+	fftplan_cache_path(buf, len, name);
+}
+
+static bool load_window(struct welch *w)
+{
+	char path[256];
+	bool ok;
+	FILE *fp;
+
+	window_path(w, path, sizeof(path));
+	fp = fopen(path, "rb");
+	if (!fp)
+		return false;
+	// exactly nfft values, anything else is a stale or torn file
+	ok = fread(w->win, sizeof(sample_t), w->nfft, fp) == w->nfft && fgetc(fp) == EOF;
+	fclose(fp);
+	return ok;
+}
+
+static void save_window(const struct welch *w)
+{
+	char path[256], tmp[280];
+	bool ok;
+	FILE *fp;
+
+	window_path(w, path, sizeof(path));
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+	fp = fopen(tmp, "wb");
+	if (!fp)
+		return;
+	ok = fwrite(w->win, sizeof(sample_t), w->nfft, fp) == w->nfft;
+	if (fclose(fp) || !ok || rename(tmp, path))
+		unlink(tmp);
+}
+
+static void window_sums(struct welch *w)
+{
+	size_t n;
+
+	w->win_sum = 0;
+	w->win_sum2 = 0;
+	for (n = 0; n < w->nfft; n++) {
+		w->win_sum += w->win[n];
+		w->win_sum2 += (double)w->win[n] * w->win[n];
+	}
+}
+
+int welch_init(struct welch *w, size_t nfft, double overlap, enum window_type window,
+		size_t max_input, enum plan_rigor rigor, struct plan_info *info)
+{
+	memset(w, 0, sizeof(*w));
+	if (nfft < 16 || overlap < 0 || overlap >= 1 || max_input == 0)
+		return -EINVAL;
+
+	w->nfft = nfft;
+	w->hop = nfft - (size_t)(overlap * nfft);
+	w->window = window;
+	w->max_input = max_input;
+
+	// as many segments as one input block can complete, all in one FFT call
+	w->nseg = (max_input - 1) / w->hop + 1;
+	if (w->nseg > MAX_BATCH)
+		w->nseg = MAX_BATCH;
+
+	w->win = FFTW(malloc)(sizeof(sample_t) * nfft);
+	w->acc = FFTW(malloc)(sizeof(sample_t) * nfft);
+	w->stage = FFTW(malloc)(sizeof(fft_complex) * (nfft + max_input));
+	w->seg = FFTW(malloc)(sizeof(fft_complex) * nfft * w->nseg);
+	if (!w->win || !w->acc || !w->stage || !w->seg) {
+		welch_free(w);
+		return -ENOMEM;
+	}
+	memset(w->acc, 0, sizeof(sample_t) * nfft);
+	// a rectangle is quicker to make than to read
+	w->win_cached = window != WINDOW_RECT && load_window(w);
+	if (!w->win_cached) {
+		make_window(w);
+		if (window != WINDOW_RECT)
+			save_window(w);
+	}
+	window_sums(w);
+
+	// in place, the windowed copy is scratch anyway
+	w->plan = fftplan_dft_batch(nfft, w->nseg, w->seg, w->seg, rigor, info);
+	w->plan1 = w->nseg > 1 ? fftplan_dft_1d(nfft, w->seg, w->seg, rigor, NULL) : w->plan;
+	if (!w->plan || !w->plan1) {
+		welch_free(w);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+void welch_free(struct welch *w)
+{
+	if (w->plan1 && w->plan1 != w->plan)
+		FFTW(destroy_plan)(w->plan1);
+	if (w->plan)
+		FFTW(destroy_plan)(w->plan);
+	FFTW(free)(w->win);
+	FFTW(free)(w->acc);
+	FFTW(free)(w->stage);
+	FFTW(free)(w->seg);
+	memset(w, 0, sizeof(*w));
+}
+
+fft_complex *welch_input(struct welch *w, size_t *space)
+{
+	*space = w->nfft + w->max_input - w->nstage;
+	return w->stage + w->nstage;
+}
+
+/* transform the queued segments and add their power to acc */
+static void run_batch(struct welch *w)
+{
+	size_t k;
+
+	if (!w->nbatch)
+		return;
+	if (w->nbatch == w->nseg) {
+		FFTW(execute)(w->plan);
+	} else {
+		for (k = 0; k < w->nbatch; k++)
+			FFTW(execute_dft)(w->plan1, w->seg + k*w->nfft, w->seg + k*w->nfft);
+	}
+
+	for (k = 0; k < w->nbatch; k++)
+		db_accumulate(w->acc, w->seg + k*w->nfft, w->nfft);
+	w->navg += w->nbatch;
+	w->nbatch = 0;
+}
+
+void welch_apply_window(fft_complex *dst, const fft_complex *src, const sample_t *win, size_t n)
+{
+	const sample_t *x = (const sample_t *)src;
+	sample_t *y = (sample_t *)dst;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		y[2*i]     = x[2*i]     * win[i];
+		y[2*i + 1] = x[2*i + 1] * win[i];
+	}
+}
+
+size_t welch_commit(struct welch *w, size_t n)
+{
+	size_t done = 0;
+
+	w->nstage += n;
+	while (w->next + w->nfft <= w->nstage) {
+		welch_apply_window(w->seg + w->nbatch*w->nfft, w->stage + w->next, w->win, w->nfft);
+		w->next += w->hop;
+		done++;
+		if (++w->nbatch == w->nseg)
+			run_batch(w);
+	}
+
+	// keep the start of the next segment, less than nfft samples
+	if (w->next) {
+		memmove(w->stage, w->stage + w->next, (w->nstage - w->next) * sizeof(fft_complex));
+		w->nstage -= w->next;
+		w->next = 0;
+	}
+	return done;
+}
+
+void welch_flush(struct welch *w)
+{
+	run_batch(w);
+}
+
+void welch_reset(struct welch *w)
+{
+	w->nstage = 0;
+	w->next = 0;
+	w->nbatch = 0;
+	w->navg = 0;
+	memset(w->acc, 0, sizeof(sample_t) * w->nfft);
+}
+
+size_t welch_average_db(struct welch *w, sample_t *db, enum db_mode mode)
+{
+	size_t half = (w->nfft + 1) / 2;
+	size_t navg;
+
+	run_batch(w);
+	navg = w->navg;
+	if (navg) {
+		sample_t offset = -10*log10(navg * w->win_sum * w->win_sum);
+
+		// fold the normalisation into the dB offset and the fftshift into
+		// where each half lands, still one pass over acc
+		db_power(db, w->acc + half, w->nfft - half, offset, mode);
+		db_power(db + w->nfft - half, w->acc, half, offset, mode);
+	} else {
+		memset(db, 0, sizeof(sample_t) * w->nfft);
+	}
+	memset(w->acc, 0, sizeof(sample_t) * w->nfft);
+	w->navg = 0;
+	return navg;
+}
+
+double welch_enbw(const struct welch *w)
+{
+	return w->nfft * w->win_sum2 / (w->win_sum * w->win_sum);
+}
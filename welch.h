@@ -0,0 +1,90 @@
+/*
+ * David Scott
+ * Spectrum analyser for AD9361 using libiio
+ * Streaming Welch power spectrum: windowed, overlapped, averaged segments
+*/
+
+#ifndef WELCH_H
+#define WELCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "dsp.h"
+#include "fftplan.h"
+#include "db.h"
+
+enum window_type {
+	WINDOW_RECT,
+	WINDOW_HANN,
+	WINDOW_BLACKMAN_HARRIS,  // 4 term, -92 dB sidelobes
+	WINDOW_FLATTOP,          // amplitude accurate tones, wide main lobe
+};
+
+/*
+	 Samples are written straight into the staging buffer (welch_input /
+	 welch_commit), segments of nfft samples every hop samples are windowed
+	 into a batch and transformed in place by one plan_many FFT. |X|^2 is
+	 accumulated in the linear power domain until welch_average_db() is called.
+	 Samples that don't complete a segment yet are kept for the next block,
+	 so overlap works across RX buffer boundaries.
+*/
+struct welch {
+	size_t nfft;             // segment length
+	size_t hop;              // samples between segment starts (nfft - overlap)
+	size_t nseg;             // segments per batched FFT
+	enum window_type window;
+
+	sample_t *win;           // precomputed window table, nfft long
+	double win_sum;          // sum(w), coherent gain * nfft
+	double win_sum2;         // sum(w^2), for noise bandwidth
+	bool win_cached;         // table read back from the cache instead of computed
+
+	fft_complex *stage;      // incoming samples, nfft + max_input long
+	size_t nstage;           // valid samples in stage
+	size_t next;             // start of the next segment in stage
+	size_t max_input;
+
+	fft_complex *seg;        // nseg windowed segments, transformed in place
+	size_t nbatch;           // segments waiting in seg
+	fft_plan plan;           // nseg segments
+	fft_plan plan1;          // one segment, for a partial batch
+
+	sample_t *acc;           // accumulated |X|^2, nfft long
+	size_t navg;             // segments in acc
+};
+
+int welch_window_parse(const char *s);
+const char *welch_window_name(enum window_type w);
+
+/* overlap is a fraction of nfft in [0, 1), max_input the largest block fed at once */
+int welch_init(struct welch *w, size_t nfft, double overlap, enum window_type window,
+		size_t max_input, enum plan_rigor rigor, struct plan_info *info);
+void welch_free(struct welch *w);
+
+/* where to write up to *space new samples, then commit how many were written */
+fft_complex *welch_input(struct welch *w, size_t *space);
+size_t welch_commit(struct welch *w, size_t n);
+
+/* transforms the segments still queued for a batch, the average below does it anyway */
+void welch_flush(struct welch *w);
+
+/* forgets staged samples, queued segments and the running average, e.g. after a retune */
+void welch_reset(struct welch *w);
+
+/* dst = src * win, one segment of n samples */
+void welch_apply_window(fft_complex *dst, const fft_complex *src, const sample_t *win, size_t n);
+
+/*
+	 Writes the average of all segments since the last call in dB,
+	 normalised by sum(w)^2 so a tone of amplitude A reads A^2 whatever the
+	 window, the normalisation fused with the 10*log10. The output is
+	 fftshifted, most negative frequency first and DC at nfft/2: bin k is
+	 at (k - nfft/2) * fs / nfft. Returns the number of segments averaged.
+*/
+size_t welch_average_db(struct welch *w, sample_t *db, enum db_mode mode);
+
+/* equivalent noise bandwidth of the window in bins */
+double welch_enbw(const struct welch *w);
+
+#endif